@@ -0,0 +1,443 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/
+
+#include <TR_CMUX.h>
+#include <TR_NoAlloc.h>
+
+// Frame delimiter
+#define CMUX_FLAG 0xF9
+
+// Frame types, poll/final bit is 0x10
+#define CMUX_SABM 0x2F
+#define CMUX_UA   0x63
+#define CMUX_DM   0x0F
+#define CMUX_DISC 0x43
+#define CMUX_UIH  0xEF
+#define CMUX_PF   0x10
+
+// Control channel message types
+#define CMUX_MSC  0xE0
+#define CMUX_CLD  0xC0
+
+TR_CMUXChannel::TR_CMUXChannel()
+{}
+
+int TR_CMUXChannel::available(void)
+{
+    // Keep every channel flowing while the caller waits on this one
+    mux->poll();
+    return (uint16_t)(rx_head - rx_tail + TR_CMUX_RX_BUFFER) % TR_CMUX_RX_BUFFER;
+}
+
+int TR_CMUXChannel::read(void)
+{
+    if(rx_head == rx_tail)
+    {
+        mux->poll();
+        if(rx_head == rx_tail)
+        {
+            return -1;
+        }
+    }
+    uint8_t c = rx_buffer[rx_tail];
+    rx_tail = (rx_tail + 1) % TR_CMUX_RX_BUFFER;
+    return c;
+}
+
+int TR_CMUXChannel::peek(void)
+{
+    if(rx_head == rx_tail)
+    {
+        return -1;
+    }
+    return rx_buffer[rx_tail];
+}
+
+size_t TR_CMUXChannel::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t TR_CMUXChannel::write(const uint8_t *buffer, size_t size)
+{
+    size_t sent = 0;
+    while(sent < size)
+    {
+        uint16_t len = size - sent;
+        if(len > TR_CMUX_N1)
+        {
+            len = TR_CMUX_N1;
+        }
+        mux->writeFrame(dlci, CMUX_UIH, buffer + sent, len);
+        sent += len;
+    }
+    return sent;
+}
+
+uint32_t TR_CMUXChannel::getOverflows(void)
+{
+    return overflows;
+}
+
+void TR_CMUXChannel::push(uint8_t c)
+{
+    // Staged past rx_head, readers only see it once the frame is checked
+    uint16_t next = (rx_stage + 1) % TR_CMUX_RX_BUFFER;
+    if(next == rx_tail)
+    {
+        stage_overflows++;
+        return;
+    }
+    rx_buffer[rx_stage] = c;
+    rx_stage = next;
+}
+
+void TR_CMUXChannel::commit(bool valid)
+{
+    if(valid)
+    {
+        rx_head = rx_stage;
+        overflows += stage_overflows;
+    }
+    else
+    {
+        rx_stage = rx_head;
+    }
+    stage_overflows = 0;
+}
+
+TR_CMUX::TR_CMUX()
+{
+    for(uint8_t i = 0; i < TR_CMUX_CHANNELS; i++)
+    {
+        channels[i].mux = this;
+        channels[i].dlci = i + 1;
+    }
+}
+
+bool TR_CMUX::begin(Stream &port_in)
+{
+    port = &port_in;
+    rx_state = eFlag;
+    
+    if(!openChannel(0))
+    {
+        Serial.println("Failed to open CMUX control channel");
+        return false;
+    }
+    
+    for(uint8_t dlci = 1; dlci <= TR_CMUX_CHANNELS; dlci++)
+    {
+        if(!openChannel(dlci))
+        {
+            Serial.print("Failed to open CMUX channel ");Serial.println(dlci);
+            return false;
+        }
+        
+        // Modem status: ready to communicate and receive (RTC, RTR, DV)
+        uint8_t msc[4];
+        msc[0] = CMUX_MSC | 0x03;
+        msc[1] = (2 << 1) | 0x01;
+        msc[2] = (dlci << 2) | 0x03;
+        msc[3] = 0x8D;
+        writeFrame(0, CMUX_UIH, msc, 4);
+    }
+    
+    return true;
+}
+
+void TR_CMUX::end(void)
+{
+    for(uint8_t dlci = TR_CMUX_CHANNELS; dlci >= 1; dlci--)
+    {
+        writeFrame(dlci, CMUX_DISC | CMUX_PF, NULL, 0);
+        setOpen(dlci, false);
+    }
+    
+    // Close down the multiplexer so the port returns to AT commands
+    uint8_t cld[2];
+    cld[0] = CMUX_CLD | 0x03;
+    cld[1] = 0x01;
+    writeFrame(0, CMUX_UIH, cld, 2);
+    control_open = false;
+}
+
+void TR_CMUX::poll(void)
+{
+    if(port == NULL)
+    {
+        return;
+    }
+    
+    while(port->available())
+    {
+        uint8_t c = (uint8_t)port->read();
+        switch(rx_state)
+        {
+            case eFlag:
+                if(c == CMUX_FLAG)
+                {
+                    rx_state = eAddress;
+                }
+                break;
+                
+            case eAddress:
+                // Consecutive flags between frames
+                if(c == CMUX_FLAG)
+                {
+                    break;
+                }
+                rx_address = c;
+                rx_fcs = crc8(0xFF, c);
+                rx_state = eControl;
+                break;
+                
+            case eControl:
+                rx_control = c;
+                rx_fcs = crc8(rx_fcs, c);
+                rx_state = eLength;
+                break;
+                
+            case eLength:
+                rx_fcs = crc8(rx_fcs, c);
+                rx_len = c >> 1;
+                rx_count = 0;
+                if(c & 0x01)
+                {
+                    rx_state = (rx_len > 0) ? eData : eFCS;
+                }
+                else
+                {
+                    rx_state = eLength2;
+                }
+                break;
+                
+            case eLength2:
+                rx_fcs = crc8(rx_fcs, c);
+                rx_len |= (uint16_t)c << 7;
+                rx_state = (rx_len > 0) ? eData : eFCS;
+                break;
+                
+            case eData:
+            {
+                // Data for virtual channels is staged in the channel buffer
+                // and released once the FCS shows the header was intact
+                if(channelData())
+                {
+                    channels[(rx_address >> 2) - 1].push(c);
+                }
+                else if(rx_count < sizeof(rx_info))
+                {
+                    rx_info[rx_count] = c;
+                }
+                rx_count++;
+                if(rx_count == rx_len)
+                {
+                    rx_state = eFCS;
+                }
+                break;
+            }
+                
+            case eFCS:
+            {
+                bool valid = (crc8(rx_fcs, c) == 0xCF);
+                if(channelData() && rx_len > 0)
+                {
+                    channels[(rx_address >> 2) - 1].commit(valid);
+                }
+                if(valid)
+                {
+                    handleFrame();
+                }
+                else
+                {
+                    fcs_errors++;
+                }
+                rx_state = eEnd;
+                break;
+            }
+                
+            case eEnd:
+                // Closing flag may also open the next frame
+                rx_state = (c == CMUX_FLAG) ? eAddress : eFlag;
+                break;
+        }
+    }
+}
+
+bool TR_CMUX::channelData(void)
+{
+    uint8_t dlci = rx_address >> 2;
+    return dlci >= 1 && dlci <= TR_CMUX_CHANNELS &&
+           (rx_control & ~CMUX_PF) == CMUX_UIH;
+}
+
+TR_CMUXChannel& TR_CMUX::channel(uint8_t dlci)
+{
+    if(dlci < 1 || dlci > TR_CMUX_CHANNELS)
+    {
+        dlci = 1;
+    }
+    return channels[dlci - 1];
+}
+
+uint32_t TR_CMUX::getFCSErrors(void)
+{
+    return fcs_errors;
+}
+
+bool TR_CMUX::openChannel(uint8_t dlci)
+{
+    for(uint8_t attempt = 0; attempt < 3; attempt++)
+    {
+        writeFrame(dlci, CMUX_SABM | CMUX_PF, NULL, 0);
+        
+        uint32_t start = millis();
+        while((millis() - start) < 1000)
+        {
+            poll();
+            if(isOpen(dlci))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TR_CMUX::writeFrame(uint8_t dlci,
+                         uint8_t control,
+                         const uint8_t *data,
+                         uint16_t len)
+{
+    uint8_t header[5];
+    uint8_t header_len;
+    
+    // Command from the initiating side sets C/R, EA marks the last byte
+    header[0] = CMUX_FLAG;
+    header[1] = (dlci << 2) | 0x03;
+    header[2] = control;
+    if(len < 128)
+    {
+        header[3] = (len << 1) | 0x01;
+        header_len = 4;
+    }
+    else
+    {
+        header[3] = (len & 0x7F) << 1;
+        header[4] = len >> 7;
+        header_len = 5;
+    }
+    
+    uint8_t fcs = 0xFF;
+    for(uint8_t i = 1; i < header_len; i++)
+    {
+        fcs = crc8(fcs, header[i]);
+    }
+    
+    uint8_t trailer[2];
+    trailer[0] = 0xFF - fcs;
+    trailer[1] = CMUX_FLAG;
+    
+    port->write(header, header_len);
+    if(len > 0)
+    {
+        port->write(data, len);
+    }
+    port->write(trailer, 2);
+}
+
+void TR_CMUX::handleFrame(void)
+{
+    uint8_t dlci = rx_address >> 2;
+    uint8_t type = rx_control & ~CMUX_PF;
+    
+    if(type == CMUX_UA)
+    {
+        setOpen(dlci, true);
+    }
+    else if(type == CMUX_DM || type == CMUX_DISC)
+    {
+        setOpen(dlci, false);
+    }
+    else if(type == CMUX_UIH && dlci == 0 && rx_count >= 2 &&
+            rx_count <= sizeof(rx_info))
+    {
+        // Answer control channel commands (C/R set) by echoing them back as
+        // responses, this covers the MSC the SIM7000 sends on each channel
+        if(rx_info[0] & 0x02)
+        {
+            rx_info[0] &= ~0x02;
+            writeFrame(0, CMUX_UIH, rx_info, rx_count);
+        }
+    }
+}
+
+void TR_CMUX::setOpen(uint8_t dlci, bool open)
+{
+    if(dlci == 0)
+    {
+        control_open = open;
+    }
+    else if(dlci <= TR_CMUX_CHANNELS)
+    {
+        channels[dlci - 1].open = open;
+    }
+}
+
+bool TR_CMUX::isOpen(uint8_t dlci)
+{
+    if(dlci == 0)
+    {
+        return control_open;
+    }
+    if(dlci <= TR_CMUX_CHANNELS)
+    {
+        return channels[dlci - 1].open;
+    }
+    return false;
+}
+
+uint8_t TR_CMUX::crc8(uint8_t crc, uint8_t c)
+{
+    // Reflected CRC-8, polynomial x^8 + x^2 + x + 1
+    crc ^= c;
+    for(uint8_t bit = 0; bit < 8; bit++)
+    {
+        if(crc & 0x01)
+        {
+            crc = (crc >> 1) ^ 0xE0;
+        }
+        else
+        {
+            crc >>= 1;
+        }
+    }
+    return crc;
+}
@@ -0,0 +1,236 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_CMUX_H_
+#define _TR_CMUX_H_
+
+#include "Arduino.h"
+
+// Virtual channels opened after the control channel (DLCI 0)
+#ifndef TR_CMUX_CHANNELS
+#define TR_CMUX_CHANNELS 2
+#endif
+
+// Receive buffer per virtual channel
+#ifndef TR_CMUX_RX_BUFFER
+#define TR_CMUX_RX_BUFFER 1024
+#endif
+
+// Largest information field sent, the GSM 07.10 default N1
+#define TR_CMUX_N1 31
+
+class TR_CMUX;
+
+/**
+ * @class TR_CMUXChannel
+ * @brief Stream for one virtual channel of a GSM 07.10 multiplexer. Reading
+ *        the channel services the physical port so frames for every channel
+ *        are demultiplexed while any one of them is being read.
+ */
+class TR_CMUXChannel : public Stream
+{
+    public:
+    
+    TR_CMUXChannel();
+    
+    int available(void) override;
+    int read(void) override;
+    int peek(void) override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    
+    /**
+     * @fn getOverflows
+     * @brief Number of received bytes dropped because the buffer was full
+     * @return Byte count
+     */
+    uint32_t getOverflows(void);
+    
+    private:
+    
+    friend class TR_CMUX;
+    
+    TR_CMUX *mux = NULL;
+    uint8_t dlci = 0;
+    bool open = false;
+    
+    // Received data ring buffer
+    uint8_t rx_buffer[TR_CMUX_RX_BUFFER];
+    uint16_t rx_head = 0;
+    uint16_t rx_tail = 0;
+    uint32_t overflows = 0;
+    
+    // End of data from the frame being received, not yet readable
+    uint16_t rx_stage = 0;
+    uint32_t stage_overflows = 0;
+    
+    /**
+     * @fn push
+     * @brief Stage a received byte in the channel buffer
+     */
+    void push(uint8_t c);
+    
+    /**
+     * @fn commit
+     * @brief Make the staged bytes of a frame readable, or drop them
+     * @param valid true if the frame passed its FCS check
+     */
+    void commit(bool valid);
+};
+
+class TR_CMUX
+{
+    public:
+    
+    /**
+     * @fn TR_CMUX
+     * @brief Multiplexer constructor
+     * @return None
+     */
+    TR_CMUX();
+    
+   /**
+    * @fn begin
+    * @brief Open the control channel and all virtual channels, the SIM7000
+    *        must already be in multiplexer mode (AT+CMUX=0)
+    * @param port SIM7000 serial port
+    * @return bool type, indicating all channels were opened
+    * @retval true Success 
+    * @retval false Failed
+    */
+    bool begin(Stream &port);
+    
+   /**
+    * @fn end
+    * @brief Close all channels and return the SIM7000 to AT command mode
+    */
+    void end(void);
+    
+   /**
+    * @fn poll
+    * @brief Demultiplex all frames received on the physical port
+    */
+    void poll(void);
+    
+   /**
+    * @fn channel
+    * @brief Stream for a virtual channel
+    * @param dlci Channel number, 1 to TR_CMUX_CHANNELS
+    * @return Channel stream
+    */
+    TR_CMUXChannel& channel(uint8_t dlci);
+    
+   /**
+    * @fn getFCSErrors
+    * @brief Number of received frames discarded for a bad FCS
+    * @return Frame count
+    */
+    uint32_t getFCSErrors(void);
+
+    private:
+    
+    friend class TR_CMUXChannel;
+    
+    typedef enum
+    {
+        eFlag,
+        eAddress,
+        eControl,
+        eLength,
+        eLength2,
+        eData,
+        eFCS,
+        eEnd,
+    }eRxState;
+    
+    // Serial port (passed in on begin) for communicating with SIM7000
+    Stream *port = NULL;
+    
+    TR_CMUXChannel channels[TR_CMUX_CHANNELS];
+    bool control_open = false;
+    
+    // Frame being received
+    eRxState rx_state = eFlag;
+    uint8_t rx_address = 0;
+    uint8_t rx_control = 0;
+    uint16_t rx_len = 0;
+    uint16_t rx_count = 0;
+    uint8_t rx_fcs = 0xFF;
+    uint8_t rx_info[16];
+    
+    uint32_t fcs_errors = 0;
+    
+    /**
+     * @fn channelData
+     * @brief Check if the frame being received carries virtual channel data
+     */
+    bool channelData(void);
+    
+    /**
+     * @fn openChannel
+     * @brief Send SABM on a channel and wait for UA
+     */
+    bool openChannel(uint8_t dlci);
+    
+    /**
+     * @fn writeFrame
+     * @brief Frame and send data on a channel
+     */
+    void writeFrame(uint8_t dlci,
+                    uint8_t control,
+                    const uint8_t *data,
+                    uint16_t len);
+    
+    /**
+     * @fn handleFrame
+     * @brief Act on a complete frame with a valid FCS
+     */
+    void handleFrame(void);
+    
+    /**
+     * @fn setOpen
+     * @brief Record the open state of a channel
+     */
+    void setOpen(uint8_t dlci, bool open);
+    
+    /**
+     * @fn isOpen
+     * @brief Check the open state of a channel
+     */
+    bool isOpen(uint8_t dlci);
+    
+    /**
+     * @fn crc8
+     * @brief Update the GSM 07.10 frame check sequence with a byte
+     */
+    uint8_t crc8(uint8_t crc, uint8_t c);
+};
+
+#endif
@@ -0,0 +1,336 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/
+
+#include <TR_Latency.h>
+#include <TR_NoAlloc.h>
+
+#define MS_PER_DAY  86400000UL
+#define MS_PER_WEEK 604800000UL
+
+TR_LatencyHistogram::TR_LatencyHistogram(uint16_t bucket_width_in)
+{
+    bucket_width = bucket_width_in > 0 ? bucket_width_in : 1;
+    reset();
+}
+
+void TR_LatencyHistogram::add(uint32_t value)
+{
+    uint32_t bucket = value / bucket_width;
+    if(bucket < TR_LATENCY_BUCKETS)
+    {
+        buckets[bucket]++;
+    }
+    else
+    {
+        overflow++;
+    }
+    
+    if(count == 0 || value < min_value)
+    {
+        min_value = value;
+    }
+    if(count == 0 || value > max_value)
+    {
+        max_value = value;
+    }
+    count++;
+    sum += value;
+}
+
+void TR_LatencyHistogram::reset(void)
+{
+    memset(buckets, 0, sizeof(buckets));
+    overflow = 0;
+    count = 0;
+    sum = 0;
+    min_value = 0;
+    max_value = 0;
+}
+
+uint32_t TR_LatencyHistogram::getCount(void)
+{
+    return count;
+}
+
+uint32_t TR_LatencyHistogram::getMin(void)
+{
+    return min_value;
+}
+
+uint32_t TR_LatencyHistogram::getMax(void)
+{
+    return max_value;
+}
+
+uint32_t TR_LatencyHistogram::getMean(void)
+{
+    return count > 0 ? (uint32_t)(sum / count) : 0;
+}
+
+uint32_t TR_LatencyHistogram::getPercentile(uint8_t percent)
+{
+    if(count == 0)
+    {
+        return 0;
+    }
+    
+    uint32_t target = ((uint64_t)count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for(uint8_t i = 0; i < TR_LATENCY_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if(seen >= target)
+        {
+            uint32_t edge = (uint32_t)(i + 1) * bucket_width;
+            return edge < max_value ? edge : max_value;
+        }
+    }
+    return max_value;
+}
+
+void TR_LatencyHistogram::print(Print &out, const char* name)
+{
+    out.print(name);
+    out.print(": n=");    out.print(count);
+    out.print(" min=");   out.print(getMin());
+    out.print(" mean=");  out.print(getMean());
+    out.print(" p50=");   out.print(getPercentile(50));
+    out.print(" p95=");   out.print(getPercentile(95));
+    out.print(" max=");   out.print(getMax());
+    out.println(" ms");
+    
+    for(uint8_t i = 0; i < TR_LATENCY_BUCKETS; i++)
+    {
+        if(buckets[i] > 0)
+        {
+            out.print("  <");
+            out.print((uint32_t)(i + 1) * bucket_width);
+            out.print(" ms: ");
+            out.println(buckets[i]);
+        }
+    }
+    if(overflow > 0)
+    {
+        out.print("  >=");
+        out.print((uint32_t)TR_LATENCY_BUCKETS * bucket_width);
+        out.print(" ms: ");
+        out.println(overflow);
+    }
+}
+
+TR_LatencyMonitor::TR_LatencyMonitor(uint16_t bucket_width)
+    : hold_time(bucket_width),
+      arrival_age(bucket_width),
+      forward_age(bucket_width)
+{
+}
+
+void TR_LatencyMonitor::setClock(uint32_t gps_tow, uint32_t at)
+{
+    clock_tow = gps_tow % MS_PER_WEEK;
+    clock_millis = at;
+    clock_set = true;
+}
+
+void TR_LatencyMonitor::setClockUTC(uint32_t date, uint32_t utc_time, uint32_t at)
+{
+    int32_t year = 2000 + date % 100;
+    int32_t month = (date / 100) % 100;
+    int32_t day = date / 10000;
+    if(month < 1 || month > 12 || day < 1)
+    {
+        return;
+    }
+    
+    // Days since 1970-01-01 for a proleptic Gregorian date
+    year -= (month <= 2);
+    int32_t era = year / 400;
+    int32_t yoe = year - era * 400;
+    int32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int32_t days = era * 146097 + doe - 719468;
+    
+    // GPS week started on Sunday 1980-01-06, day 3657 after 1970-01-01
+    uint32_t day_of_week = (uint32_t)(days - 3657) % 7;
+    uint32_t tow = day_of_week * MS_PER_DAY + utc_time + TR_GPS_LEAP_SECONDS * 1000UL;
+    setClock(tow, at);
+}
+
+bool TR_LatencyMonitor::isClockSet(void)
+{
+    return clock_set;
+}
+
+uint32_t TR_LatencyMonitor::getTOW(uint32_t at)
+{
+    return (clock_tow + (at - clock_millis)) % MS_PER_WEEK;
+}
+
+void TR_LatencyMonitor::onChunk(const uint8_t *data, uint16_t len, uint32_t arrival)
+{
+    uint32_t forward = millis();
+    hold_time.add(forward - arrival);
+    
+    for(uint16_t i = 0; i < len; i++)
+    {
+        uint8_t c = data[i];
+        
+        // Hunt for the preamble between frames
+        if(frame_pos == 0 && c != 0xD3)
+        {
+            continue;
+        }
+        
+        if(frame_pos < sizeof(header))
+        {
+            header[frame_pos] = c;
+        }
+        frame_pos++;
+        
+        if(frame_pos == 3)
+        {
+            // Preamble, 6 reserved bits and a 10 bit length, plus CRC
+            frame_len = (((uint16_t)(header[1] & 0x03) << 8) | header[2]) + 6;
+            if((header[1] & 0xFC) != 0 || frame_len < 9)
+            {
+                frame_pos = 0;
+            }
+        }
+        else if(frame_pos == sizeof(header))
+        {
+            onMessage(arrival, forward);
+        }
+        
+        if(frame_pos > 3 && frame_pos == frame_len)
+        {
+            frame_pos = 0;
+        }
+    }
+}
+
+TR_LatencyHistogram& TR_LatencyMonitor::getHoldTime(void)
+{
+    return hold_time;
+}
+
+TR_LatencyHistogram& TR_LatencyMonitor::getArrivalAge(void)
+{
+    return arrival_age;
+}
+
+TR_LatencyHistogram& TR_LatencyMonitor::getForwardAge(void)
+{
+    return forward_age;
+}
+
+void TR_LatencyMonitor::print(Print &out)
+{
+    hold_time.print(out, "Hold");
+    arrival_age.print(out, "Age at arrival");
+    forward_age.print(out, "Age at forward");
+}
+
+void TR_LatencyMonitor::reset(void)
+{
+    hold_time.reset();
+    arrival_age.reset();
+    forward_age.reset();
+}
+
+void TR_LatencyMonitor::onMessage(uint32_t arrival, uint32_t forward)
+{
+    if(!clock_set)
+    {
+        return;
+    }
+    
+    // Message type and epoch follow the 3 byte frame header, the epoch is
+    // after the 12 bit type and 12 bit station ID
+    uint16_t type = getBits(24, 12);
+    uint32_t period;
+    uint32_t epoch;
+    
+    if((type >= 1001 && type <= 1004) ||
+       (type >= 1071 && type <= 1077) ||
+       (type >= 1091 && type <= 1097) ||
+       (type >= 1101 && type <= 1107) ||
+       (type >= 1111 && type <= 1117))
+    {
+        // GPS, Galileo, SBAS and QZSS epochs are GPS time of week
+        epoch = getBits(48, 30);
+        period = MS_PER_WEEK;
+    }
+    else if(type >= 1121 && type <= 1127)
+    {
+        // BeiDou time is 14 s behind GPS time
+        epoch = getBits(48, 30) + 14000;
+        period = MS_PER_WEEK;
+    }
+    else if((type >= 1009 && type <= 1012) ||
+            (type >= 1081 && type <= 1087))
+    {
+        // GLONASS epochs are Moscow (UTC+3) time of day, MSM adds a 3 bit
+        // day of week in front of it
+        epoch = (type >= 1081) ? getBits(51, 27) : getBits(48, 27);
+        epoch = (epoch + MS_PER_DAY - 3 * 3600000UL + TR_GPS_LEAP_SECONDS * 1000UL) % MS_PER_DAY;
+        period = MS_PER_DAY;
+    }
+    else
+    {
+        return;
+    }
+    
+    if(epoch >= period)
+    {
+        return;
+    }
+    
+    uint32_t arrival_now = getTOW(arrival) % period;
+    uint32_t forward_now = getTOW(forward) % period;
+    uint32_t age_arrival = (arrival_now + period - epoch) % period;
+    uint32_t age_forward = (forward_now + period - epoch) % period;
+    
+    // An epoch ahead of the clock means the clock is off, not a huge age
+    if(age_forward > period / 2)
+    {
+        return;
+    }
+    arrival_age.add(age_arrival);
+    forward_age.add(age_forward);
+}
+
+uint32_t TR_LatencyMonitor::getBits(uint16_t pos, uint8_t len)
+{
+    uint32_t value = 0;
+    for(uint16_t i = pos; i < pos + len; i++)
+    {
+        value = (value << 1) | ((header[i / 8] >> (7 - i % 8)) & 1);
+    }
+    return value;
+}
@@ -0,0 +1,242 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_LATENCY_H_
+#define _TR_LATENCY_H_
+
+#include "Arduino.h"
+
+// Histogram buckets, values past the last bucket are counted as overflow
+#ifndef TR_LATENCY_BUCKETS
+#define TR_LATENCY_BUCKETS 32
+#endif
+
+// GPS time is ahead of UTC by the leap seconds since 1980
+#ifndef TR_GPS_LEAP_SECONDS
+#define TR_GPS_LEAP_SECONDS 18
+#endif
+
+class TR_LatencyHistogram
+{
+    public:
+    
+    /**
+     * @fn TR_LatencyHistogram
+     * @brief Histogram constructor
+     * @param bucket_width_in Width of each bucket (milliseconds)
+     * @return None
+     */
+    TR_LatencyHistogram(uint16_t bucket_width_in = 50);
+    
+   /**
+    * @fn add
+    * @brief Add a sample
+    * @param value Latency (milliseconds)
+    */
+    void add(uint32_t value);
+    
+   /**
+    * @fn reset
+    * @brief Clear all samples
+    */
+    void reset(void);
+    
+   /**
+    * @fn getCount
+    * @brief Number of samples
+    * @return Sample count
+    */
+    uint32_t getCount(void);
+    
+   /**
+    * @fn getMin
+    * @brief Smallest sample
+    * @return Latency (milliseconds)
+    */
+    uint32_t getMin(void);
+    
+   /**
+    * @fn getMax
+    * @brief Largest sample
+    * @return Latency (milliseconds)
+    */
+    uint32_t getMax(void);
+    
+   /**
+    * @fn getMean
+    * @brief Mean of the samples
+    * @return Latency (milliseconds)
+    */
+    uint32_t getMean(void);
+    
+   /**
+    * @fn getPercentile
+    * @brief Upper edge of the bucket holding a percentile
+    * @param percent Percentile, 50 for the median
+    * @return Latency (milliseconds), the maximum if it is in the overflow
+    */
+    uint32_t getPercentile(uint8_t percent);
+    
+   /**
+    * @fn print
+    * @brief Log a one line summary and the non-empty buckets
+    * @param out Destination, for example Serial
+    * @param name Label for the line
+    */
+    void print(Print &out, const char* name);
+
+    private:
+    
+    uint16_t bucket_width;
+    uint32_t buckets[TR_LATENCY_BUCKETS];
+    uint32_t overflow = 0;
+    uint32_t count = 0;
+    uint64_t sum = 0;
+    uint32_t min_value = 0;
+    uint32_t max_value = 0;
+};
+
+class TR_LatencyMonitor
+{
+    public:
+    
+    /**
+     * @fn TR_LatencyMonitor
+     * @brief Correction latency monitor constructor
+     * @param bucket_width Histogram bucket width (milliseconds)
+     * @return None
+     */
+    TR_LatencyMonitor(uint16_t bucket_width = 50);
+    
+   /**
+    * @fn setClock
+    * @brief Set the GPS time of week at a millis() timestamp
+    * @param gps_tow GPS time of week (milliseconds)
+    * @param at millis() when gps_tow was current
+    */
+    void setClock(uint32_t gps_tow, uint32_t at);
+    
+   /**
+    * @fn setClockUTC
+    * @brief Set the UTC date and time at a millis() timestamp, for example
+    *        from the date and time of a TR_NMEAParser fix
+    * @param date UTC date as ddmmyy
+    * @param utc_time UTC time of day (milliseconds)
+    * @param at millis() when utc_time was current
+    */
+    void setClockUTC(uint32_t date, uint32_t utc_time, uint32_t at);
+    
+   /**
+    * @fn isClockSet
+    * @brief Check whether ages can be computed
+    * @return bool type, indicating a clock has been set
+    */
+    bool isClockSet(void);
+    
+   /**
+    * @fn getTOW
+    * @brief GPS time of week at a millis() timestamp
+    * @param at millis() timestamp
+    * @return GPS time of week (milliseconds)
+    */
+    uint32_t getTOW(uint32_t at);
+    
+   /**
+    * @fn onChunk
+    * @brief Record a chunk of correction data as it is forwarded
+    * @param data Chunk of the caster stream
+    * @param len Length of the chunk
+    * @param arrival millis() when the chunk's first byte was received
+    */
+    void onChunk(const uint8_t *data, uint16_t len, uint32_t arrival);
+    
+   /**
+    * @fn getHoldTime
+    * @brief Time from a chunk's arrival to its forward
+    * @return Histogram
+    */
+    TR_LatencyHistogram& getHoldTime(void);
+    
+   /**
+    * @fn getArrivalAge
+    * @brief Age of observation messages when their chunk arrived
+    * @return Histogram
+    */
+    TR_LatencyHistogram& getArrivalAge(void);
+    
+   /**
+    * @fn getForwardAge
+    * @brief Age of observation messages when their chunk was forwarded
+    * @return Histogram
+    */
+    TR_LatencyHistogram& getForwardAge(void);
+    
+   /**
+    * @fn print
+    * @brief Log all three distributions
+    * @param out Destination, for example Serial
+    */
+    void print(Print &out);
+    
+   /**
+    * @fn reset
+    * @brief Clear all distributions, the clock is kept
+    */
+    void reset(void);
+
+    private:
+    
+    TR_LatencyHistogram hold_time;
+    TR_LatencyHistogram arrival_age;
+    TR_LatencyHistogram forward_age;
+    
+    // GPS time of week at clock_millis
+    bool clock_set = false;
+    uint32_t clock_tow = 0;
+    uint32_t clock_millis = 0;
+    
+    // RTCM frame being tracked, only the start of the message is kept
+    uint8_t header[10];
+    uint16_t frame_pos = 0;
+    uint16_t frame_len = 0;
+    
+    /**
+     * @fn onMessage
+     * @brief Record the ages of a message once its header is known
+     */
+    void onMessage(uint32_t arrival, uint32_t forward);
+    
+    /**
+     * @fn getBits
+     * @brief Read an unsigned big-endian bit field from the header
+     */
+    uint32_t getBits(uint16_t pos, uint8_t len);
+};
+
+#endif
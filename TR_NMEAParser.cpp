@@ -0,0 +1,260 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/
+
+#include <TR_NMEAParser.h>
+#include <TR_NoAlloc.h>
+
+TR_NMEAParser::TR_NMEAParser()
+{
+    memset(&fix, 0, sizeof(fix));
+    gga[0] = '\0';
+}
+
+uint8_t TR_NMEAParser::feed(const char *data, uint16_t len)
+{
+    uint8_t updates = 0;
+    
+    for(uint16_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+        
+        // A '$' always starts a sentence, even mid line after an AT response
+        if(c == '$')
+        {
+            line_len = 0;
+            line_overflow = false;
+        }
+        
+        if(c == '\n')
+        {
+            if(!line_overflow && line_len > 0 && line[0] == '$')
+            {
+                line[line_len] = '\0';
+                if(parse(line))
+                {
+                    updates++;
+                }
+            }
+            line_len = 0;
+            line_overflow = false;
+        }
+        else if(c != '\r')
+        {
+            if(line_len < TR_NMEA_LINE - 1)
+            {
+                line[line_len++] = c;
+            }
+            else
+            {
+                line_overflow = true;
+            }
+        }
+    }
+    
+    return updates;
+}
+
+bool TR_NMEAParser::parse(char *sentence)
+{
+    if(sentence[0] != '$')
+    {
+        return false;
+    }
+    
+    // Validate the XOR checksum of the characters between '$' and '*'
+    uint8_t checksum = 0;
+    char *p = sentence + 1;
+    while(*p != '\0' && *p != '*')
+    {
+        checksum ^= (uint8_t)*p;
+        p++;
+    }
+    if(*p != '*' || hexValue(p[1]) < 0 || hexValue(p[2]) < 0 ||
+       (uint8_t)((hexValue(p[1]) << 4) | hexValue(p[2])) != checksum)
+    {
+        checksum_errors++;
+        return false;
+    }
+    sentences++;
+    
+    // GGA is kept whole for caster upload before it is tokenized
+    size_t body_len = (p + 3) - sentence;
+    bool is_gga = body_len > 6 && 0 == strncmp(sentence + 3, "GGA,", 4);
+    if(is_gga && body_len + 3 <= sizeof(gga))
+    {
+        memcpy(gga, sentence, body_len);
+        memcpy(gga + body_len, "\r\n", 3);
+    }
+    
+    // Split the fields in place, the address field keeps the talker
+    *p = '\0';
+    field_count = 0;
+    fields[field_count++] = sentence + 1;
+    for(char *c = sentence + 1; *c != '\0'; c++)
+    {
+        if(*c == ',')
+        {
+            *c = '\0';
+            if(field_count < TR_NMEA_FIELDS)
+            {
+                fields[field_count++] = c + 1;
+            }
+        }
+    }
+    
+    // Talker (GP, GN, GL ...) is ignored
+    if(strlen(fields[0]) != 5)
+    {
+        return false;
+    }
+    
+    bool updated = false;
+    if(is_gga)
+    {
+        updated = parseGGA();
+    }
+    else if(0 == strcmp(fields[0] + 2, "RMC"))
+    {
+        updated = parseRMC();
+    }
+    
+    if(updated && fix_callback != NULL)
+    {
+        fix_callback(fix);
+    }
+    return updated;
+}
+
+void TR_NMEAParser::setFixCallback(void (*callback)(const gnssFix &fix))
+{
+    fix_callback = callback;
+}
+
+const gnssFix& TR_NMEAParser::getFix(void)
+{
+    return fix;
+}
+
+const char* TR_NMEAParser::getGGA(void)
+{
+    return gga;
+}
+
+uint32_t TR_NMEAParser::getSentences(void)
+{
+    return sentences;
+}
+
+uint32_t TR_NMEAParser::getChecksumErrors(void)
+{
+    return checksum_errors;
+}
+
+bool TR_NMEAParser::parseGGA(void)
+{
+    // $--GGA,time,lat,N,lon,E,quality,sats,hdop,alt,M,sep,M,age,station
+    if(field_count < 10)
+    {
+        return false;
+    }
+    
+    fix.time = parseTime(fields[1]);
+    fix.quality = atoi(fields[6]);
+    fix.satellites = atoi(fields[7]);
+    fix.hdop = atof(fields[8]);
+    fix.valid = (fix.quality > 0) && fields[2][0] != '\0' && fields[4][0] != '\0';
+    if(fix.valid)
+    {
+        fix.latitude = parseCoordinate(fields[2], fields[3]);
+        fix.longitude = parseCoordinate(fields[4], fields[5]);
+        fix.altitude = atof(fields[9]);
+    }
+    
+    return true;
+}
+
+bool TR_NMEAParser::parseRMC(void)
+{
+    // $--RMC,time,status,lat,N,lon,E,speed,course,date,...
+    if(field_count < 10)
+    {
+        return false;
+    }
+    
+    fix.time = parseTime(fields[1]);
+    fix.valid = (fields[2][0] == 'A') && fields[3][0] != '\0' && fields[5][0] != '\0';
+    if(fix.valid)
+    {
+        fix.latitude = parseCoordinate(fields[3], fields[4]);
+        fix.longitude = parseCoordinate(fields[5], fields[6]);
+        fix.speed = atof(fields[7]);
+        fix.course = atof(fields[8]);
+    }
+    fix.date = strtoul(fields[9], NULL, 10);
+    
+    return true;
+}
+
+uint32_t TR_NMEAParser::parseTime(const char *field)
+{
+    if(strlen(field) < 6)
+    {
+        return 0;
+    }
+    
+    uint32_t hours = (field[0] - '0') * 10 + (field[1] - '0');
+    uint32_t minutes = (field[2] - '0') * 10 + (field[3] - '0');
+    double seconds = atof(field + 4);
+    
+    return (hours * 3600 + minutes * 60) * 1000 + (uint32_t)(seconds * 1000.0 + 0.5);
+}
+
+double TR_NMEAParser::parseCoordinate(const char *field, const char *hemisphere)
+{
+    double value = atof(field);
+    int degrees = (int)(value / 100.0);
+    double result = degrees + (value - degrees * 100.0) / 60.0;
+    
+    if(hemisphere[0] == 'S' || hemisphere[0] == 'W')
+    {
+        result = -result;
+    }
+    return result;
+}
+
+int TR_NMEAParser::hexValue(char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
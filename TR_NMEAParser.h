@@ -0,0 +1,172 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_NMEAPARSER_H_
+#define _TR_NMEAPARSER_H_
+
+#include "Arduino.h"
+
+// Longest sentence held, NMEA 0183 limits sentences to 82 characters
+#define TR_NMEA_LINE 96
+
+// Most fields tokenized in one sentence
+#define TR_NMEA_FIELDS 24
+
+typedef struct
+{
+    uint32_t time;      // UTC time of day (milliseconds)
+    uint32_t date;      // UTC date as ddmmyy, 0 until an RMC is parsed
+    double latitude;    // Degrees, south negative
+    double longitude;   // Degrees, west negative
+    float altitude;     // Height above mean sea level (m)
+    float hdop;
+    float speed;        // Speed over ground (knots)
+    float course;       // Course over ground (degrees)
+    uint8_t quality;    // GGA fix quality, 0 no fix, 4 RTK fixed, 5 RTK float
+    uint8_t satellites;
+    bool valid;
+}gnssFix;
+
+class TR_NMEAParser
+{
+    public:
+    
+    /**
+     * @fn TR_NMEAParser
+     * @brief NMEA parser constructor
+     * @return None
+     */
+    TR_NMEAParser();
+    
+   /**
+    * @fn feed
+    * @brief Parse the next chunk of NMEA output, for example from
+    *        AT+CGNSTST or the GNSS NMEA port. Lines that are not NMEA
+    *        sentences, such as AT responses, are ignored.
+    * @param data Chunk of receiver output
+    * @param len Length of the chunk
+    * @return Number of sentences in the chunk that updated the fix
+    */
+    uint8_t feed(const char *data, uint16_t len);
+    
+   /**
+    * @fn parse
+    * @brief Validate and parse one complete sentence, the sentence is
+    *        tokenized in place so its contents are modified
+    * @param sentence Null terminated sentence starting with '$'
+    * @return bool type, indicating a GGA or RMC sentence updated the fix
+    */
+    bool parse(char *sentence);
+    
+   /**
+    * @fn setFixCallback
+    * @brief Set a function called each time a sentence updates the fix
+    * @param callback Function receiving the updated fix
+    */
+    void setFixCallback(void (*callback)(const gnssFix &fix));
+    
+   /**
+    * @fn getFix
+    * @brief Most recent fix
+    * @return Fix, valid is false until a sentence reports a position
+    */
+    const gnssFix& getFix(void);
+    
+   /**
+    * @fn getGGA
+    * @brief Most recent valid GGA sentence, for upload to a caster
+    * @return Sentence including checksum and line ending, empty if none
+    */
+    const char* getGGA(void);
+    
+   /**
+    * @fn getSentences
+    * @brief Number of sentences with a valid checksum
+    * @return Sentence count
+    */
+    uint32_t getSentences(void);
+    
+   /**
+    * @fn getChecksumErrors
+    * @brief Number of sentences dropped for a bad or missing checksum
+    * @return Sentence count
+    */
+    uint32_t getChecksumErrors(void);
+
+    private:
+    
+    // Line being assembled by feed()
+    char line[TR_NMEA_LINE];
+    uint8_t line_len = 0;
+    bool line_overflow = false;
+    
+    // Fields of the sentence being parsed, pointing into the sentence
+    char *fields[TR_NMEA_FIELDS];
+    uint8_t field_count = 0;
+    
+    gnssFix fix;
+    char gga[TR_NMEA_LINE];
+    
+    void (*fix_callback)(const gnssFix &fix) = NULL;
+    
+    uint32_t sentences = 0;
+    uint32_t checksum_errors = 0;
+    
+    /**
+     * @fn parseGGA
+     * @brief Update the fix from GGA fields
+     */
+    bool parseGGA(void);
+    
+    /**
+     * @fn parseRMC
+     * @brief Update the fix from RMC fields
+     */
+    bool parseRMC(void);
+    
+    /**
+     * @fn parseTime
+     * @brief Convert hhmmss.sss to milliseconds of the day
+     */
+    uint32_t parseTime(const char *field);
+    
+    /**
+     * @fn parseCoordinate
+     * @brief Convert (d)ddmm.mmmm and a hemisphere to signed degrees
+     */
+    double parseCoordinate(const char *field, const char *hemisphere);
+    
+    /**
+     * @fn hexValue
+     * @brief Value of a hex digit, -1 if it is not one
+     */
+    int hexValue(char c);
+};
+
+#endif
@@ -0,0 +1,309 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/
+
+#include <TR_RTCMFilter.h>
+#include <TR_NoAlloc.h>
+
+TR_RTCMFilter::TR_RTCMFilter()
+{}
+
+void TR_RTCMFilter::setDefaultAction(eAction action)
+{
+    default_action = action;
+}
+
+bool TR_RTCMFilter::setRule(uint16_t msg_type,
+                            eAction action,
+                            uint16_t decimation)
+{
+    rtcmRule *rule = findRule(msg_type, true);
+    if(rule == NULL)
+    {
+        rule = reclaimRule(msg_type);
+        if(rule == NULL)
+        {
+            return false;
+        }
+    }
+    
+    rule->automatic = false;
+    rule->action = action;
+    rule->decimation = (decimation == 0) ? 1 : decimation;
+    rule->decimation_count = 0;
+    return true;
+}
+
+uint16_t TR_RTCMFilter::filter(const char *in,
+                               uint16_t in_len,
+                               char *out,
+                               uint16_t out_max)
+{
+    uint16_t out_len = 0;
+    
+    for(uint16_t i = 0; i < in_len; i++)
+    {
+        uint8_t c = (uint8_t)in[i];
+        
+        // Skip everything up to a preamble
+        if(frame_len == 0 && c != 0xD3)
+        {
+            continue;
+        }
+        frame[frame_len++] = c;
+        
+        // Rescanning after a bad candidate can leave complete frames in
+        // the assembled bytes, so keep checking until more input is needed
+        while(frame_len >= 3)
+        {
+            // Header: preamble, 6 reserved zero bits and a 10 bit length
+            if((frame[1] & 0xFC) != 0)
+            {
+                crc_errors++;
+                discard(1);
+                continue;
+            }
+            
+            uint16_t frame_size = (((frame[1] & 0x03) << 8) | frame[2]) + 6;
+            if(frame_len < frame_size)
+            {
+                break;
+            }
+            
+            uint32_t crc = ((uint32_t)frame[frame_size - 3] << 16) |
+                           ((uint32_t)frame[frame_size - 2] << 8) |
+                           frame[frame_size - 1];
+            if(crc != crc24q(frame, frame_size - 3))
+            {
+                crc_errors++;
+                discard(1);
+                continue;
+            }
+            
+            if(forwardFrame())
+            {
+                if((uint32_t)out_len + frame_size <= out_max)
+                {
+                    memcpy(out + out_len, frame, frame_size);
+                    out_len += frame_size;
+                }
+                else
+                {
+                    overflows++;
+                }
+            }
+            discard(frame_size);
+        }
+    }
+    
+    return out_len;
+}
+
+uint32_t TR_RTCMFilter::getPassed(uint16_t msg_type)
+{
+    rtcmRule *rule = findRule(msg_type, false);
+    return (rule == NULL) ? 0 : rule->passed;
+}
+
+uint32_t TR_RTCMFilter::getDropped(uint16_t msg_type)
+{
+    rtcmRule *rule = findRule(msg_type, false);
+    return (rule == NULL) ? 0 : rule->dropped;
+}
+
+uint32_t TR_RTCMFilter::getCRCErrors(void)
+{
+    return crc_errors;
+}
+
+uint32_t TR_RTCMFilter::getOverflows(void)
+{
+    return overflows;
+}
+
+void TR_RTCMFilter::resetCounters(void)
+{
+    for(uint8_t i = 0; i < num_rules; i++)
+    {
+        rules[i].passed = 0;
+        rules[i].dropped = 0;
+    }
+    other_passed = 0;
+    other_dropped = 0;
+    crc_errors = 0;
+    overflows = 0;
+}
+
+TR_RTCMFilter::rtcmRule* TR_RTCMFilter::findRule(uint16_t msg_type, bool add)
+{
+    for(uint8_t i = 0; i < num_rules; i++)
+    {
+        if(rules[i].msg_type == msg_type)
+        {
+            return &rules[i];
+        }
+    }
+    
+    if(!add || num_rules == TR_RTCM_MAX_RULES)
+    {
+        return NULL;
+    }
+    
+    rtcmRule *rule = &rules[num_rules++];
+    rule->msg_type = msg_type;
+    rule->automatic = true;
+    rule->action = default_action;
+    rule->decimation = 1;
+    rule->decimation_count = 0;
+    rule->passed = 0;
+    rule->dropped = 0;
+    return rule;
+}
+
+TR_RTCMFilter::rtcmRule* TR_RTCMFilter::reclaimRule(uint16_t msg_type)
+{
+    // Reuse the least used rule that only holds counters
+    rtcmRule *rule = NULL;
+    for(uint8_t i = 0; i < num_rules; i++)
+    {
+        if(rules[i].automatic &&
+           (rule == NULL || 
+            (rules[i].passed + rules[i].dropped) < (rule->passed + rule->dropped)))
+        {
+            rule = &rules[i];
+        }
+    }
+    if(rule == NULL)
+    {
+        return NULL;
+    }
+    
+    // Its frames are counted with the other message types from now on
+    other_passed += rule->passed;
+    other_dropped += rule->dropped;
+    
+    rule->msg_type = msg_type;
+    rule->action = default_action;
+    rule->decimation = 1;
+    rule->decimation_count = 0;
+    rule->passed = 0;
+    rule->dropped = 0;
+    return rule;
+}
+
+bool TR_RTCMFilter::forwardFrame(void)
+{
+    // Message number is the first 12 bits of the payload
+    uint16_t payload_len = ((frame[1] & 0x03) << 8) | frame[2];
+    if(payload_len < 2)
+    {
+        return false;
+    }
+    uint16_t msg_type = ((uint16_t)frame[3] << 4) | (frame[4] >> 4);
+    
+    // Message types seen for the first time get a rule with the default
+    // action so they have their own counters
+    rtcmRule *rule = findRule(msg_type, true);
+    if(rule == NULL)
+    {
+        if(default_action == eDrop)
+        {
+            other_dropped++;
+            return false;
+        }
+        other_passed++;
+        return true;
+    }
+    
+    // Rules created for counters follow the current default action
+    uint8_t action = rule->automatic ? default_action : rule->action;
+    bool forward = false;
+    if(action == ePass)
+    {
+        forward = true;
+    }
+    else if(action == eDecimate)
+    {
+        forward = (rule->decimation_count == 0);
+        rule->decimation_count++;
+        if(rule->decimation_count >= rule->decimation)
+        {
+            rule->decimation_count = 0;
+        }
+    }
+    
+    if(forward)
+    {
+        rule->passed++;
+    }
+    else
+    {
+        rule->dropped++;
+    }
+    return forward;
+}
+
+void TR_RTCMFilter::discard(uint16_t length)
+{
+    // Drop the leading bytes then skip ahead to the next preamble
+    uint16_t i;
+    for(i = length; i < frame_len; i++)
+    {
+        if(frame[i] == 0xD3)
+        {
+            break;
+        }
+    }
+    
+    if(i >= frame_len)
+    {
+        frame_len = 0;
+        return;
+    }
+    
+    memmove(frame, frame + i, frame_len - i);
+    frame_len -= i;
+}
+
+uint32_t TR_RTCMFilter::crc24q(const uint8_t *buffer, uint16_t length)
+{
+    uint32_t crc = 0;
+    for(uint16_t i = 0; i < length; i++)
+    {
+        crc ^= (uint32_t)buffer[i] << 16;
+        for(uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc <<= 1;
+            if(crc & 0x1000000)
+            {
+                crc ^= 0x1864CFB;
+            }
+        }
+    }
+    return crc & 0xFFFFFF;
+}
@@ -0,0 +1,216 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_RTCMFILTER_H_
+#define _TR_RTCMFILTER_H_
+
+#include "Arduino.h"
+
+// Number of message types with their own rule and counters
+#ifndef TR_RTCM_MAX_RULES
+#define TR_RTCM_MAX_RULES 24
+#endif
+
+// Largest RTCM 3 frame: 3 byte header, 1023 byte payload, 3 byte CRC
+#define TR_RTCM_MAX_FRAME 1029
+
+class TR_RTCMFilter
+{
+    public:
+    
+    /**
+      * @enum eAction
+      * @brief What to do with frames of a message type
+      */
+      typedef enum
+      {
+          ePass,
+          eDrop,
+          eDecimate,
+      }eAction;
+    
+    /**
+     * @fn TR_RTCMFilter
+     * @brief RTCM filter constructor, all message types pass by default
+     * @return None
+     */
+    TR_RTCMFilter();
+    
+   /**
+    * @fn setDefaultAction
+    * @brief Set the action for message types without a rule
+    * @param action ePass or eDrop
+    */
+    void setDefaultAction(eAction action);
+    
+   /**
+    * @fn setRule
+    * @brief Set the action for a message type
+    * @param msg_type RTCM message number, for example 1005 or 1077
+    * @param action ePass, eDrop or eDecimate
+    * @param decimation For eDecimate, forward one of every decimation frames
+    * @details Message types seen in the stream get a rule of their own
+    *          for their counters while there is room. When the table is
+    *          full, the least used of those is given up for this rule and
+    *          its counts move to the other message types.
+    * @return bool type, indicating the rule was stored
+    * @retval true Success 
+    * @retval false Rule table is full of rules set with setRule()
+    */
+    bool setRule(uint16_t msg_type,
+                 eAction action,
+                 uint16_t decimation = 1);
+    
+   /**
+    * @fn filter
+    * @brief Filter a chunk of the correction stream, for example the bytes
+    *        returned by TR_SIM7000::readTCP()
+    * @details Frames may span chunks, partial frames are held until the rest
+    *          arrives. Only complete frames with a valid CRC are forwarded,
+    *          bytes outside of frames are discarded.
+    * @param in Chunk of the correction stream
+    * @param in_len Length of the chunk
+    * @param out Buffer for forwarded frames, should hold at least
+    *            in_len + TR_RTCM_MAX_FRAME bytes
+    * @param out_max Size of the output buffer
+    * @return Number of bytes written to out
+    */
+    uint16_t filter(const char *in,
+                    uint16_t in_len,
+                    char *out,
+                    uint16_t out_max);
+    
+   /**
+    * @fn getPassed
+    * @brief Number of frames of a message type forwarded
+    * @param msg_type RTCM message number
+    * @return Frame count
+    */
+    uint32_t getPassed(uint16_t msg_type);
+    
+   /**
+    * @fn getDropped
+    * @brief Number of frames of a message type dropped or decimated away
+    * @param msg_type RTCM message number
+    * @return Frame count
+    */
+    uint32_t getDropped(uint16_t msg_type);
+    
+   /**
+    * @fn getCRCErrors
+    * @brief Number of candidate frames rejected for a bad CRC or header
+    * @return Frame count
+    */
+    uint32_t getCRCErrors(void);
+    
+   /**
+    * @fn getOverflows
+    * @brief Number of frames dropped because the output buffer was full
+    * @return Frame count
+    */
+    uint32_t getOverflows(void);
+    
+   /**
+    * @fn resetCounters
+    * @brief Clear all frame counters, rules are kept
+    */
+    void resetCounters(void);
+
+    private:
+    
+    // Per message type rule and counters
+    typedef struct
+    {
+        uint16_t msg_type;
+        bool automatic;     // Created for counters, not by setRule()
+        uint8_t action;
+        uint16_t decimation;
+        uint16_t decimation_count;
+        uint32_t passed;
+        uint32_t dropped;
+    }rtcmRule;
+    
+    rtcmRule rules[TR_RTCM_MAX_RULES];
+    uint8_t num_rules = 0;
+    
+    // Action for message types without a rule
+    eAction default_action = ePass;
+    
+    // Counters for message types that did not fit in the rule table
+    uint32_t other_passed = 0;
+    uint32_t other_dropped = 0;
+    
+    uint32_t crc_errors = 0;
+    uint32_t overflows = 0;
+    
+    // Frame being assembled
+    uint8_t frame[TR_RTCM_MAX_FRAME];
+    uint16_t frame_len = 0;
+    
+    /**
+     * @fn findRule
+     * @brief Find the rule for a message type
+     * @param msg_type RTCM message number
+     * @param add Add a rule with the default action if none exists
+     * @return Rule or NULL
+     */
+    rtcmRule* findRule(uint16_t msg_type, bool add);
+    
+    /**
+     * @fn reclaimRule
+     * @brief Give the least used rule that was not set with setRule() to
+     *        another message type
+     * @param msg_type RTCM message number
+     * @return Rule or NULL if every rule was set with setRule()
+     */
+    rtcmRule* reclaimRule(uint16_t msg_type);
+    
+    /**
+     * @fn forwardFrame
+     * @brief Apply the rule for a complete frame
+     * @return bool type, indicating the frame should be forwarded
+     */
+    bool forwardFrame(void);
+    
+    /**
+     * @fn discard
+     * @brief Remove bytes from the front of the assembled frame and skip
+     *        ahead to the next preamble
+     * @param length Number of bytes to remove
+     */
+    void discard(uint16_t length);
+    
+    /**
+     * @fn crc24q
+     * @brief Compute the RTCM 3 CRC-24Q of a buffer
+     */
+    uint32_t crc24q(const uint8_t *buffer, uint16_t length);
+};
+
+#endif
@@ -28,12 +28,85 @@
 **********************************************************************/
 
 #include <TR_SIM7000.h>
+#include <TR_Sourcetable.h>
+#include <TR_CMUX.h>
+#include <TR_NMEAParser.h>
+#include <TR_Latency.h>
 
-#include<base64.h>
 #include <string>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef TR_SIM7000_COUNT_ALLOC
+#include <new>
+
+static volatile uint32_t allocation_count = 0;
+
+#ifdef TR_SIM7000_WRAP_MALLOC
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t count, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+    
+    void *__wrap_malloc(size_t size)
+    {
+        allocation_count++;
+        return __real_malloc(size);
+    }
+    
+    void *__wrap_calloc(size_t count, size_t size)
+    {
+        allocation_count++;
+        return __real_calloc(count, size);
+    }
+    
+    void *__wrap_realloc(void *ptr, size_t size)
+    {
+        allocation_count++;
+        return __real_realloc(ptr, size);
+    }
+}
+#define TR_MALLOC __real_malloc
+#else
+#define TR_MALLOC malloc
+#endif
+
+// Array and nothrow forms default to this operator new
+void *operator new(size_t size)
+{
+    allocation_count++;
+    return TR_MALLOC(size);
+}
+
+uint32_t TR_SIM7000::getAllocationCount(void)
+{
+    return allocation_count;
+}
+#endif
+
+// After the allocation counter, which defines operator new
+#include <TR_NoAlloc.h>
+
+// Append a character to a rolling window, dropping the oldest when full
+static void pushWindow(char *window, uint8_t &len, uint8_t size, char c)
+{
+    if(len == size)
+    {
+        memmove(window, window + 1, len - 1);
+        len--;
+    }
+    window[len++] = c;
+}
+
+// Check whether a rolling window ends with a token
+static bool windowEndsWith(const char *window, uint8_t len, const char *token)
+{
+    uint8_t token_len = strlen(token);
+    return (token_len > 0 && len >= token_len &&
+            0 == memcmp(window + len - token_len, token, token_len));
+}
+
 TR_SIM7000::TR_SIM7000()
 {}
 
@@ -46,7 +119,8 @@ void TR_SIM7000::init(int pwr_pin,
                       char* user_in,
                       char* psw_in,
                       char* info_in,
-                      Stream &input_port)
+                      Stream &input_port,
+                      eStack stack_in)
 {
     sim7000Serial = &input_port;
     PWRKEY = pwr_pin;
@@ -58,15 +132,33 @@ void TR_SIM7000::init(int pwr_pin,
     user = user_in;
     psw = psw_in;
     info = info_in;
+    tcp_stack = stack_in;
 }
 
 bool TR_SIM7000::connect()
 {
-    // Turn on SIM7000
-    Serial.print("Turning On SIM7000 ... ");
-    if(turnON())
+    // Adopt a SIM7000 that kept running through a host reset rather than
+    // power cycling it and losing the registration and PDP context
+    Serial.print("Probing SIM7000 ... ");
+    eResume state = resume();
+    if(state >= eResumeAttached)
+    {
+        Serial.println("Resumed existing network connection");
+        return true;
+    }
+    
+    if(state == eResumeNone)
+    {
+        // Turn on SIM7000
+        Serial.print("Turning On SIM7000 ... ");
+        if(turnON())
+        {
+            Serial.println("SIM7000 is On");
+        }
+    }
+    else
     {
-        Serial.println("SIM7000 is On");
+        Serial.println("SIM7000 already on");
     }
 
     // Check SIM card
@@ -90,7 +182,27 @@ bool TR_SIM7000::connect()
     {
         Serial.println("Failed to set mode");
     }
-    delay(100);
+    
+    // Follow registration from here so the radio searches while the rest
+    // of setup runs
+    if (!startRegistration())
+    {
+        Serial.println("Failed to enable registration reports");
+    }
+    
+    // A stored cell avoids scanning every band
+    if (cell_load != NULL)
+    {
+        Serial.print("Registering on stored cell ... ");
+        if (applyCachedCell())
+        {
+            Serial.println("Registered");
+        }
+        else
+        {
+            Serial.println("Failed, scanning all bands");
+        }
+    }
 
     Serial.print("Closing any existing network connection ... ");
     if (closeNetwork())
@@ -101,7 +213,6 @@ bool TR_SIM7000::connect()
     {
         Serial.println("Failed to close network connections");
     }
-    delay(1000);
 
     // Get signal quality
     Serial.print("Getting signal quality ...");
@@ -135,7 +246,6 @@ bool TR_SIM7000::connect()
     Serial.println("Opening connection with provider's service ... ");
     if (attachService())
     {
-        delay(100);
         Serial.println("Connection opened");
     }
     else
@@ -143,7 +253,6 @@ bool TR_SIM7000::connect()
         Serial.println("Failed to open connection");
         while (1);
     }
-    delay(200);
     
     return true;
 }
@@ -176,6 +285,83 @@ bool TR_SIM7000::turnON(void)
 
 }
 
+TR_SIM7000::eResume TR_SIM7000::resume(void (*set_host_baud)(long))
+{
+    if(!probe())
+    {
+        // Search the rates the SIM7000 may have been left at
+        const long rates[] = {115200, 57600, 38400, 19200, 9600};
+        bool found = false;
+        if(set_host_baud != NULL)
+        {
+            for(uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]) && !found; i++)
+            {
+                set_host_baud(rates[i]);
+                if(probe())
+                {
+                    baud_rate = rates[i];
+                    found = true;
+                }
+            }
+            if(!found)
+            {
+                set_host_baud(baud_rate);
+            }
+        }
+        if(!found)
+        {
+            Serial.println("SIM7000 not responding");
+            return eResumeNone;
+        }
+    }
+    Serial.print("SIM7000 responding at ");Serial.println(baud_rate);
+    
+    if(!isRegistered())
+    {
+        return eResumeModem;
+    }
+    
+    if(!queryIPAddress())
+    {
+        return eResumeRegistered;
+    }
+    Serial.print("IP address is: ");Serial.println(ip_address);
+    
+    if(!checkTCP())
+    {
+        return eResumeAttached;
+    }
+    Serial.println("TCP connection still open");
+    
+    if(tcp_stack == eCIP)
+    {
+        // Without the multiplexer state a transparent connection can't be
+        // read, and CIPSTART refuses a second connection
+        if(querySetting("AT+CIPMODE?\r\n", "+CIPMODE: 1"))
+        {
+            Serial.println("Closing connection left in transparent mode");
+            closeConnection();
+            return eResumeAttached;
+        }
+        
+        // Data is read the way the SIM7000 was left set up
+        manual_rx = querySetting("AT+CIPRXGET?\r\n", "+CIPRXGET: 1");
+        if(querySetting("AT+CIPQSEND?\r\n", "+CIPQSEND: 1"))
+        {
+            setQuickSend(true);
+        }
+    }
+    
+    resumed_socket = true;
+    setLinkUp();
+    return eResumeConnected;
+}
+
+const char* TR_SIM7000::getIPAddress(void)
+{
+    return ip_address;
+}
+
 bool TR_SIM7000::setBaudRate(long rate)
 {
     uint8_t count = 0;
@@ -297,497 +483,3097 @@ bool TR_SIM7000::setNetMode(eNet net)
 
 bool TR_SIM7000::attachService(void)
 {
-    // Attach to GPRS service
-    char gprsBuffer[32];
-    cleanBuffer(gprsBuffer,32);
-    sendCmd("AT+CGATT=1\r\n");
-    while(1)
+    if(!reg_urcs && !startRegistration())
+    {
+        return false;
+    }
+    
+    // Move on to PDP setup the moment the network reports registration
+    uint32_t start = millis();
+    while(reg_state != eRegHome && reg_state != eRegRoaming)
     {
-        readBuffer(gprsBuffer, 320);
-        if(NULL != strstr(gprsBuffer, "OK"))
+        if(reg_state == eRegDenied)
         {
-            delay(100);
-            break;  
+            Serial.println("ERROR: Network registration denied");
+            return false;
         }
-        if(NULL != strstr(gprsBuffer, "ERROR"))
+        if((millis() - start) > TR_REGISTRATION_TIMEOUT)
         {
+            Serial.println("ERROR: Not registered to network");
             return false;
         }
+        char c;
+        readChar(c);
+    }
+    if(reg_state == eRegHome)
+    {
+        Serial.println("Registered to home network");
+    }
+    else
+    {
+        Serial.println("Registered as roaming");
+    }
+    
+    if(cell_save != NULL)
+    {
+        recordCell();
+    }
+    
+    // Attach to GPRS service
+    sendCmd("AT+CGATT=1\r\n");
+    if(!waitFor("OK", "ERROR", 75000))
+    {
+        Serial.println("Failure to attach to GPRS service");
+        return false;
+    }
+    Serial.println("Attached to GPRS service");
+    
+    if(tcp_stack == eCA)
+    {
+        // The CA command set activates its own PDP context with AT+CNACT
+        return activateCAContext();
     }
     
     // Set providers APN
     char apn_command[64];
     sprintf(apn_command, "AT+CSTT=\"%s\"\r\n", APN);
     sendCmd(apn_command);
-    cleanBuffer(gprsBuffer,32);
-    while(1)
+    if(!waitFor("OK", "ERROR"))
     {
-        readBuffer(gprsBuffer, 32);
-        if(NULL != strstr(gprsBuffer, "OK"))
-        {
-            Serial.print("Provider APN set to ");
-            Serial.println(APN);
-            delay(200);
-            break;
-        }
-        else if(NULL != strstr(gprsBuffer,"ERROR"))
-        {
-            Serial.println("Error setting provider APN");
-            return false;
-        }
+        Serial.println("Error setting provider APN");
+        return false;
     }
-  
+    Serial.print("Provider APN set to ");
+    Serial.println(APN);
+    
     // Open wireless connection with GPRS
     sendCmd("AT+CIICR\r\n");
-    while(1)
+    if(!waitFor("OK", "ERROR", 85000))
     {
-        readBuffer(gprsBuffer, 32, 4000);
-        if(NULL != strstr(gprsBuffer, "OK"))
-        {
-            Serial.println("Wireless connection opened");
-            delay(200);
-            break;
-        }
-        else if(NULL != strstr(gprsBuffer,"ERROR"))
-        {
-            Serial.println("Error opening wireless connection");
-            return false;
-        }
+        Serial.println("Error opening wireless connection");
+        return false;
     }
+    Serial.println("Wireless connection opened");
     
-    // Open wireless connection with GPRS
-    cleanBuffer(gprsBuffer,32);
-    sendCmd("AT+CIFSR\r\n");
-    while(1)
+    // Read the assigned IP address into the fixed buffer
+    if(!queryIPAddress())
     {
-        int buff_length = readBuffer(gprsBuffer, 32, 4000);
-        if(NULL != strstr(gprsBuffer,"ERROR"))
-        {
-            Serial.println("Error reading IP address");
-            return false;
-        }
-        else
-        {
-            uint8_t first_char = 11;
-            char* ip_addr = (char*)malloc((strlen(gprsBuffer) - 10) * sizeof(char));
-            for (int i=first_char;i<buff_length-2;i++)
-            {
-                ip_addr[i-first_char] = gprsBuffer[i];
-            }
-            Serial.print("IP address is: ");Serial.println(ip_addr);
-            delay(200);
-            break;
-        }
+        Serial.println("Error reading IP address");
+        return false;
     }
+    Serial.print("IP address is: ");Serial.println(ip_address);
     
-    sendCmd("AT+CEREG?\r\n");
-    while(1)
+    return true;
+}
+
+void TR_SIM7000::setCellStorage(bool (*load)(cellInfo &cell),
+                                void (*save)(const cellInfo &cell))
+{
+    cell_load = load;
+    cell_save = save;
+}
+
+bool TR_SIM7000::applyCachedCell(void)
+{
+    if(cell_load == NULL || !cell_load(cell))
     {
-        readBuffer(gprsBuffer, 32, 4000);
-        if(NULL != strstr(gprsBuffer, "+CEREG: 0,0"))
-        {
-            Serial.println("ERROR: Not registered to network (+CEREG: 0,0)");
-            delay(2000);
-            return false;
-        }
-        else if(NULL != strstr(gprsBuffer, "+CEREG: 0,1"))
-        {
-            Serial.println("Registered to home network");
-            break;
-        }
-        else if(NULL != strstr(gprsBuffer, "+CEREG: 0,2"))
-        {
-            Serial.println("Searching for network (+CEREG: 0,2)");
-            delay(2000);
-            break;
-        }
-        else if(NULL != strstr(gprsBuffer, "+CEREG: 0,3"))
-        {
-            Serial.println("ERROR: Network registration denied (+CEREG: 0,3)");
-            delay(2000);
-            return false;
-        }
-        else if(NULL != strstr(gprsBuffer, "+CEREG: 0,4"))
-        {
-            Serial.println("ERROR: Undefined response (+CEREG: 0,4)");
-            delay(2000);
-            return false;
-        }
-        else if(NULL != strstr(gprsBuffer, "+CEREG: 0,5"))
-        {
-            Serial.println("Registered as roaming");
-            break;
-        }
-        else if(NULL != strstr(gprsBuffer,"ERROR"))
-        {
-            Serial.println("CEREG Error");
-            return false;
-        }
-        delay(1000);
+        return false;
     }
     
-    sendCmd("AT+CGATT?\r\n");
-    while(1)
+    // Only LTE cells are narrowed to a band
+    if(cell.band == 0 || (cell.act != 7 && cell.act != 9) || cell.oper[0] == '\0')
     {
-        readBuffer(gprsBuffer, 32, 4000);
-        if(NULL != strstr(gprsBuffer, "OK"))
-        {
-            Serial.println("Attached to GPRS service");
-            delay(200);
-            break;
-        }
-        else if(NULL != strstr(gprsBuffer,"ERROR"))
-        {
-            Serial.println("Failure to attach to GPRS service");
-            return false;
-        }
+        return false;
     }
     
-
-    return true;
-}
-
-int TR_SIM7000::checkSignalQuality(void)
-{
-    char signalBuffer[26];
-    int i = 0,j = 0,k = 0;
-    char *signalQuality;
-    cleanBuffer(signalBuffer,26);
-    sendCmd("AT+CSQ\r\n");
-    readBuffer(signalBuffer,26);
-    //Serial.println(signalBuffer);
-    if(NULL != (signalQuality = strstr(signalBuffer, "+CSQ:")))
+    char cell_command[96];
+    const char* mode = (cell.act == 9) ? "NB-IOT" : "CAT-M";
+    if(cell.act == 9 && !checkSendCmd("AT+CMNB=2\r\n","OK"))
     {
-        i = *(signalQuality + 6) - 48;
-        j = *(signalQuality + 7) - 48;
-        k =  (i * 10) + j;
+        return false;
     }
-    else
+    sprintf(cell_command, "AT+CBANDCFG=\"%s\",%d\r\n", mode, cell.band);
+    if(!checkSendCmd(cell_command,"OK"))
     {
-        return 0;
+        return false;
     }
     
-    if( k == 99)
+    // Manual selection falls back to automatic, so its OK does not show
+    // the stored cell was used until the serving cell is read back
+    sprintf(cell_command, "AT+COPS=4,2,\"%s\",%d\r\n", cell.oper, cell.act);
+    sendCmd(cell_command);
+    cellInfo found = {0, 0, ""};
+    bool locked = waitFor("OK", "ERROR", TR_CELL_LOCK_TIMEOUT) && 
+                  isRegistered() && 
+                  readServingCell(found) &&
+                  found.band == cell.band && 
+                  0 == strcmp(found.oper, cell.oper);
+    
+    // Every band is searched again so the SIM7000 can reselect later
+    sprintf(cell_command, "AT+CBANDCFG=\"%s\",%s\r\n", mode, 
+            (cell.act == 9) ? TR_NBIOT_BANDS : TR_CATM_BANDS);
+    checkSendCmd(cell_command,"OK");
+    if(locked)
     {
-        return 0;
+        return true;
     }
-    else
+    
+    // Restore automatic selection, attachService() waits for registration
+    if(cell.act == 9)
     {
-        return k;
+        checkSendCmd("AT+CMNB=1\r\n","OK");
     }
+    sendCmd("AT+COPS=0\r\n");
+    waitFor("OK", "ERROR", TR_CELL_LOCK_TIMEOUT);
+    return false;
 }
 
-int TR_SIM7000::signalRSSI(int signal_quality)
+bool TR_SIM7000::recordCell(void)
 {
-    int rssi = 0;
-    
-    if(signal_quality == 0)
-        rssi = -115;
-    else if (signal_quality == 1)
-        rssi = -111;
-    else
+    cellInfo found = {0, 0, ""};
+    if(!readServingCell(found))
     {
-        rssi = (-110+(2*(signal_quality-2)));
+        return false;
     }
     
-    return rssi;
+    if(found.act != cell.act || found.band != cell.band || 
+       0 != strcmp(found.oper, cell.oper))
+    {
+        cell = found;
+        Serial.print("Storing cell: operator ");Serial.print(cell.oper);
+        Serial.print(" band ");Serial.println(cell.band);
+        cell_save(cell);
+    }
+    return true;
 }
 
-String TR_SIM7000::getSignalQualityDescriptor(int signal_quality)
+bool TR_SIM7000::readServingCell(cellInfo &found)
 {
-    String signal_quality_indicator = "";
-    if(signal_quality >= 18)
-        signal_quality_indicator = "Great";
-    else if(signal_quality >= 13)
-        signal_quality_indicator = "Good";
-    else if(signal_quality >= 8)
-        signal_quality_indicator = "Average";
-    else if(signal_quality >= 3)
-        signal_quality_indicator = "Below Average";
-    else if(signal_quality < 3)
-        signal_quality_indicator = "Poor";
-    
-    return signal_quality_indicator;
-}
-
-bool TR_SIM7000::establishTCPConnectionClient()
-{ 
-    // Create new connection
-    char num[4];
-    char resp[1024];
-    sendCmd("AT+CIPSTART=\"TCP\",\"");
-    sendCmd(host);
-    sendCmd("\",");
-    itoa(tcp_port, num, 10);
-    sendCmd(num);
-    sendCmd("\r\n");
+    char cell_resp[96];
     
-    Serial.print("Establishing TCP connection ...");
-    
-    cleanBuffer(resp, 1024);
-    bool connection_success = false;
-    while(1)
+    // Response is +CPSI: <mode>,<state>,...,EUTRAN-BAND<n>,...
+    sendCmd("AT+CPSI?\r\n");
+    if(!waitFor("+CPSI: ", "ERROR") || !readLine(cell_resp, sizeof(cell_resp)))
     {
-        while(checkReadable())
-        {
-            readBuffer(resp, 1024);
-            if(NULL != strstr(resp,"CONNECT OK"))
-            {
-                Serial.print("Connection succesful, ");
-                connection_success = true;
-            }
-            if(NULL != strstr(resp,"ERROR"))
-            {
-                Serial.println("Connection rejected");
-                return false;
-            }
-        }
-        if(connection_success)
-            break;
+        return false;
+    }
+    waitFor("OK", "ERROR", 500);
+    if(0 == strncmp(cell_resp, "LTE CAT-M", 9))
+    {
+        found.act = 7;
+    }
+    else if(0 == strncmp(cell_resp, "LTE NB-IOT", 10))
+    {
+        found.act = 9;
+    }
+    char *band = strstr(cell_resp, "EUTRAN-BAND");
+    if(band != NULL)
+    {
+        found.band = atoi(band + 11);
+    }
+    
+    // Numeric operator, response is +COPS: <mode>,2,"<oper>",<act>
+    if(!checkSendCmd("AT+COPS=3,2\r\n","OK"))
+    {
+        return false;
+    }
+    sendCmd("AT+COPS?\r\n");
+    bool read = waitFor("+COPS: ", "ERROR") && readLine(cell_resp, sizeof(cell_resp));
+    if(read)
+    {
+        waitFor("OK", "ERROR", 500);
+    }
+    
+    // Back to the long alphanumeric operator name
+    checkSendCmd("AT+COPS=3,0\r\n","OK");
+    
+    char *start = strchr(cell_resp, '"');
+    if(!read || start == NULL)
+    {
+        return false;
+    }
+    start++;
+    char *end = strchr(start, '"');
+    if(end == NULL || (end - start) >= (int)sizeof(found.oper))
+    {
+        return false;
+    }
+    memcpy(found.oper, start, end - start);
+    found.oper[end - start] = '\0';
+    return true;
+}
+
+bool TR_SIM7000::startRegistration(void)
+{
+    if(!checkSendCmd("AT+CEREG=2\r\n","OK"))
+    {
+        return false;
+    }
+    reg_urcs = true;
+    
+    // Seed the status, later changes arrive as URCs
+    isRegistered();
+    return true;
+}
+
+TR_SIM7000::eReg TR_SIM7000::getRegistration(void)
+{
+    return reg_state;
+}
+
+void TR_SIM7000::setRegistrationCallback(void (*callback)(eReg state))
+{
+    reg_callback = callback;
+}
+
+void TR_SIM7000::parseRegistration(const char *line)
+{
+    // A URC is <stat>[,<tac>,<ci>,<AcT>] and a query response puts <n>
+    // in front, so the field count tells them apart
+    uint8_t fields = 1;
+    for(const char *c = line; *c != '\0'; c++)
+    {
+        if(*c == ',')
+        {
+            fields++;
+        }
+    }
+    
+    const char *stat = line;
+    if(fields == 2 || fields == 5)
+    {
+        stat = strchr(line, ',') + 1;
+    }
+    if(*stat < '0' || *stat > '5')
+    {
+        return;
+    }
+    
+    eReg state = (eReg)(*stat - '0');
+    reg_reports++;
+    if(state != reg_state)
+    {
+        reg_state = state;
+        if(reg_callback != NULL)
+        {
+            reg_callback(state);
+        }
+    }
+}
+
+int TR_SIM7000::checkSignalQuality(void)
+{
+    char signalBuffer[26];
+    int i = 0,j = 0,k = 0;
+    char *signalQuality;
+    cleanBuffer(signalBuffer,26);
+    sendCmd("AT+CSQ\r\n");
+    readBuffer(signalBuffer,26);
+    //Serial.println(signalBuffer);
+    if(NULL != (signalQuality = strstr(signalBuffer, "+CSQ:")))
+    {
+        i = *(signalQuality + 6) - 48;
+        j = *(signalQuality + 7) - 48;
+        k =  (i * 10) + j;
+    }
+    else
+    {
+        return 0;
+    }
+    
+    if( k == 99)
+    {
+        return 0;
+    }
+    else
+    {
+        return k;
+    }
+}
+
+int TR_SIM7000::signalRSSI(int signal_quality)
+{
+    int rssi = 0;
+    
+    if(signal_quality == 0)
+        rssi = -115;
+    else if (signal_quality == 1)
+        rssi = -111;
+    else
+    {
+        rssi = (-110+(2*(signal_quality-2)));
+    }
+    
+    return rssi;
+}
+
+const char* TR_SIM7000::getSignalQualityDescriptor(int signal_quality)
+{
+    if(signal_quality >= 18)
+        return "Great";
+    else if(signal_quality >= 13)
+        return "Good";
+    else if(signal_quality >= 8)
+        return "Average";
+    else if(signal_quality >= 3)
+        return "Below Average";
+    
+    return "Poor";
+}
+
+bool TR_SIM7000::establishTCPConnectionClient()
+{ 
+    // With the multiplexer running the caster stream has its own channel
+    if(data_port != NULL)
+    {
+        return establishTransparentClient();
+    }
+    
+    // The caster is still streaming on a connection resume() found open
+    if(resumed_socket)
+    {
+        resumed_socket = false;
+        setLinkUp();
+        Serial.println("Reusing open TCP connection");
+        return true;
+    }
+    
+    if(!openConnection())
+    {
+        return false;
+    }
+    
+    if(tcp_stack == eCIP)
+    {
+        sendCmd("AT+CIPSEND\r\n");
+        if(!waitFor(">", "ERROR", 5000))
+        {
+            Serial.println("CIPSEND failed");
+            return false;
+        }
+        Serial.println("Ready to send");
+        delay(100);
+    }
+    
+    Serial.print("Requesting NTRIP ... ");
+    char request[TR_NTRIP_REQUEST_MAX];
+    size_t request_len = ntripRequest(request, sizeof(request));
+    if(request_len == 0)
+    {
+        Serial.println("NTRIP request too long");
+        return false;
+    }
+    
+    if(tcp_stack == eCA)
+    {
+        if(!sendRequest(request, request_len))
+        {
+            Serial.println("CASEND failed");
+            return false;
+        }
+    }
+    else
+    {
+        sim7000Serial->write((const uint8_t*)request, request_len);
+        // Indicate end of write
+        sim7000Serial->write(0x1a);
+    }
+    
+    return readCasterReply(10000);
+}
+
+bool TR_SIM7000::readCasterReply(uint32_t timeout)
+{
+    // Only the status line is read, the data after it is left for readTCP()
+    char line[48];
+    uint8_t len = 0;
+    bool pull = (data_port == NULL && (tcp_stack == eCA || manual_rx));
+    
+    // A caster that accepts the connection but never answers is a failure
+    uint32_t start = millis();
+    while((millis() - start) < timeout)
+    {
+        // Each receive request is a round trip, so pull modes ask for the
+        // shortest status line at once and the rest a byte at a time
+        char chunk[11];
+        uint16_t chunk_len = readSocket(chunk, (pull && len < 10) ? 11 - len : 1);
+        for(uint16_t i = 0; i < chunk_len; i++)
+        {
+            // The space after the send prompt is not part of the reply
+            if(chunk[i] == '\r' || (chunk[i] == ' ' && len == 0))
+            {
+                continue;
+            }
+            if(chunk[i] != '\n')
+            {
+                if(len < sizeof(line) - 1)
+                {
+                    line[len++] = chunk[i];
+                }
+                continue;
+            }
+            line[len] = '\0';
+            
+            // Without +IPD headers send results and URCs arrive first
+            if(len == 0 || line[0] == '+' || 0 == strcmp(line, "SEND OK") ||
+               0 == strncmp(line, "DATA ACCEPT", 11))
+            {
+                len = 0;
+                continue;
+            }
+            if(NULL != strstr(line, "ICY 200 OK"))
+            {
+                Serial.println("Received expected response from caster");
+                return true;
+            }
+            Serial.print("Connection rejected: ");Serial.println(line);
+            return false;
+        }
+    }
+    Serial.println("No response from caster");
+    return false;
+}
+
+bool TR_SIM7000::establishTCPConnectionServer()
+{ 
+    if(!openConnection())
+    {
+        return false;
+    }
+    
+    // Build the request string
+    char data_to_send[TR_NTRIP_REQUEST_MAX];
+    int request_len = snprintf(data_to_send, sizeof(data_to_send),
+                               "SOURCE %s %s\r\n"
+                               "Source-Agent: AT_NTRIP v1.0\r\n"
+                               "STR: \r\n"
+                               "%s\r\n"
+                               "\x1A",
+                               psw, mntpnt, info);
+    if(request_len < 0 || request_len >= (int)sizeof(data_to_send))
+    {
+        Serial.println("NTRIP request too long");
+        return false;
+    }
+    
+    // Send the request string
+    if(tcp_stack == eCA)
+    {
+        // Length is explicit with CASEND so the trailing Ctrl-Z is not sent
+        if(!sendRequest(data_to_send, strlen(data_to_send) - 1))
+        {
+            Serial.println("CASEND failed");
+            return false;
+        }
+        Serial.print("Sent ");
+        Serial.println(data_to_send);
+        Serial.println("TCP Connection Succesful\n");
+        return true;
+    }
+    
+    sendCmd(data_to_send);
+    Serial.print("Sent ");
+    delay(25);
+    Serial.println(data_to_send);
+
+    sendCmd(data_to_send);
+    // Indicate end of write
+    sim7000Serial->write(0x1a);
+    
+    Serial.println("TCP Connection Succesful\n");
+
+    return true;
+}
+
+uint16_t TR_SIM7000::readTCP(char *buff, uint16_t maxlen)
+{
+    uint16_t avail;
+
+    // Read buffer to get response
+    char gprsBuffer[maxlen];
+    cleanBuffer(gprsBuffer,maxlen);
+    int i;
+    uint32_t arrival = millis();
+    if(data_port != NULL)
+    {
+        i=readSocket(gprsBuffer,maxlen);
+    }
+    else if(tcp_stack == eCA || manual_rx)
+    {
+        // Finish a receive request started by readAvailable() first
+        i = 0;
+        uint32_t start = millis();
+        while(pull_state != ePullIdle && i < maxlen && (millis() - start) < 1000)
+        {
+            i += pullAvailable(gprsBuffer + i, maxlen - i);
+        }
+        if(i == 0 && pull_state == ePullIdle)
+        {
+            i=pullTCP(gprsBuffer,maxlen);
+        }
+    }
+    else if(rx_stash != NULL)
+    {
+        // Data is framed by +IPD headers, read until the line goes idle
+        i = 0;
+        uint32_t idle = millis();
+        while(i < maxlen && (millis() - idle) < 500)
+        {
+            uint16_t len = readSocket(gprsBuffer + i, maxlen - i);
+            if(len > 0)
+            {
+                if(i == 0)
+                {
+                    arrival = millis();
+                }
+                i += len;
+                idle = millis();
+            }
+        }
+    }
+    else
+    {
+        i=readBuffer(gprsBuffer,maxlen,500);
+        arrival = rx_first;
+    }
+    Serial.print("Read TCP data of length ");Serial.println(i);
+    
+    // Copy buffer to pointer passed in
+    memcpy(buff,gprsBuffer,i);
+    recordRx(buff, i, arrival);
+    
+    // Return length of data read
+    return i;
+}
+
+void TR_SIM7000::recordRx(const char *buff, uint16_t len, uint32_t arrival)
+{
+    if(len == 0)
+    {
+        return;
+    }
+    
+    last_rx = millis();
+    
+    // Line ends left over from the caster's reply are not correction data
+    bool data = false;
+    for(uint16_t i = 0; i < len && !data; i++)
+    {
+        data = (buff[i] != '\r' && buff[i] != '\n');
+    }
+    if(awaiting_first && data && active_caster >= 0)
+    {
+        casterSource &caster = casters[active_caster];
+        uint32_t waited = ((int32_t)(arrival - connected_at) > 0) ? arrival - connected_at : 0;
+        recordLatency(caster.first_byte, caster.worst_first_byte, waited);
+        awaiting_first = false;
+    }
+    if(latency != NULL)
+    {
+        latency->onChunk((const uint8_t*)buff, len, arrival);
+    }
+}
+
+boolean TR_SIM7000::checkTCP(void)
+{
+    // A connection already known to be dead needs no round trip
+    if(link_state != eLinkUp)
+    {
+        return false;
+    }
+    
+    if(tcp_stack == eCA)
+    {
+        char state[24];
+        sprintf(state, "+CASTATE: %d,1", ca_cid);
+        return checkSendCmd("AT+CASTATE?\r\n",state,1000);
+    }
+    
+    if(checkSendCmd("AT+CIPSTATUS\r\n","STATE: CONNECT OK",1000))
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool TR_SIM7000::send(char *data)
+{
+    return send(data, strlen(data));
+}
+
+bool TR_SIM7000::send(char *buf, size_t len)
+{
+    sendSegment segment = {buf, len};
+    return sendv(&segment, 1);
+}
+
+bool TR_SIM7000::sendv(const sendSegment *segments, uint8_t count)
+{
+    if(data_port != NULL)
+    {
+        for(uint8_t i = 0; i < count; i++)
+        {
+            if(data_port->write((const uint8_t*)segments[i].data, segments[i].len) != segments[i].len)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    return sendSegments(segments, count);
+}
+
+bool TR_SIM7000::startMux(TR_CMUX &mux_in)
+{
+    // Transparent mode can only be selected before the PDP context is up,
+    // a SIM7000 resumed after a host reset may already be in it
+    if(!querySetting("AT+CIPMODE?\r\n", "+CIPMODE: 1") &&
+       !checkSendCmd("AT+CIPMODE=1\r\n","OK"))
+    {
+        Serial.println("Failed to set transparent mode");
+        return false;
+    }
+    
+    if(!checkSendCmd("AT+CMUX=0\r\n","OK"))
+    {
+        Serial.println("Failed to start multiplexer");
+        return false;
+    }
+    
+    if(!mux_in.begin(*sim7000Serial))
+    {
+        return false;
+    }
+    
+    // Channel 1 carries the caster stream, channel 2 AT commands
+    mux = &mux_in;
+    raw_port = sim7000Serial;
+    data_port = &mux_in.channel(1);
+    sim7000Serial = &mux_in.channel(2);
+    
+    return checkSendCmd("AT\r\n","OK");
+}
+
+void TR_SIM7000::stopMux(void)
+{
+    if(mux == NULL)
+    {
+        return;
+    }
+    
+    mux->end();
+    sim7000Serial = raw_port;
+    data_port = NULL;
+    mux = NULL;
+}
+
+bool TR_SIM7000::findNearestMountpoint(TR_Sourcetable &table,
+                                       double lat,
+                                       double lon,
+                                       uint32_t timeout)
+{
+    // Reuse the last result while the rover stays close to where it was
+    if(table.isCachedFor(lat, lon))
+    {
+        mntpnt = (char*)table.getNearest();
+        return true;
+    }
+    
+    table.begin(lat, lon);
+    
+    // The caster closes this connection when the table ends, which is not
+    // a lost caster link
+    eLink saved_link = link_state;
+    link_quiet = true;
+    bool found = fetchSourcetable(table, timeout);
+    link_quiet = false;
+    link_state = saved_link;
+    if(!found)
+    {
+        return false;
+    }
+    
+    Serial.print(table.getCount());Serial.println(" mount points");
+    
+    if(table.getNearest()[0] == '\0')
+    {
+        Serial.println("No suitable mount point found");
+        return false;
+    }
+    
+    mntpnt = (char*)table.getNearest();
+    Serial.print("Nearest mount point is ");Serial.print(mntpnt);
+    Serial.print(" at ");Serial.print(table.getNearestDistance());Serial.println(" km");
+    return true;
+}
+
+bool TR_SIM7000::fetchSourcetable(TR_Sourcetable &table, uint32_t timeout)
+{
+    if(!openConnection())
+    {
+        return false;
+    }
+    
+    const char request[] = "GET / HTTP/1.0\r\n"
+                           "User-Agent: NTRIP TR_SIM7000\r\n"
+                           "Accept: */*\r\n"
+                           "Connection: close\r\n"
+                           "\r\n";
+    if(!sendRequest(request, strlen(request)))
+    {
+        Serial.println("Sourcetable request failed");
+        closeConnection();
+        return false;
+    }
+    
+    Serial.print("Reading sourcetable ... ");
+    
+    // Parse the table as it arrives rather than holding it in memory. A
+    // receive request already started is finished before closing.
+    char chunk[256];
+    uint32_t start = millis();
+    while((!table.isComplete() || pull_state != ePullIdle) && 
+          (millis() - start) < timeout)
+    {
+        uint16_t len = readSocket(chunk, sizeof(chunk));
+        table.feed(chunk, len);
+    }
+    
+    // A receive request cut short by the timeout ends with the connection
+    pull_state = ePullIdle;
+    cmd_pending = false;
+    closeConnection();
+    return true;
+}
+
+bool TR_SIM7000::setManualReceive(bool enable)
+{
+    if(enable)
+    {
+        if(!checkSendCmd("AT+CIPRXGET=1\r\n","OK"))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if(!checkSendCmd("AT+CIPRXGET=0\r\n","OK"))
+        {
+            return false;
+        }
+    }
+    manual_rx = enable;
+    return true;
+}
+
+uint16_t TR_SIM7000::availableTCP(void)
+{
+    if(tcp_stack == eCA || !manual_rx)
+    {
+        return 0;
+    }
+    
+    // Response is +CIPRXGET: 4,<cnflength>
+    sendCmd("AT+CIPRXGET=4\r\n");
+    if(!waitFor("+CIPRXGET: 4,", "ERROR"))
+    {
+        return 0;
+    }
+    uint16_t len = readNumber();
+    waitFor("OK", "ERROR", 500);
+    
+    return len;
+}
+
+bool TR_SIM7000::setQuickSend(bool enable, uint32_t window)
+{
+    if(!checkSendCmd(enable ? "AT+CIPQSEND=1\r\n" : "AT+CIPQSEND=0\r\n","OK"))
+    {
+        return false;
+    }
+    
+    if(enable && window == 0)
+    {
+        // Response is +CIPSEND: <size>
+        sendCmd("AT+CIPSEND?\r\n");
+        if(waitFor("+CIPSEND: ", "ERROR"))
+        {
+            window = readNumber();
+            waitFor("OK", "ERROR", 500);
+        }
+        if(window == 0)
+        {
+            window = TR_SEND_MAX;
+        }
+    }
+    
+    quick_send = enable;
+    qsend_window = window;
+    qsend_unacked = 0;
+    qsend_pending = 0;
+    qsend_acked = 0;
+    qsend_progress = millis();
+    return true;
+}
+
+bool TR_SIM7000::updateInFlight(void)
+{
+    // Response is +CIPACK: <txlen>,<acklen>,<nacklen>
+    char ack_resp[40];
+    sendCmd("AT+CIPACK\r\n");
+    if(!waitFor("+CIPACK: ", "ERROR") || !readLine(ack_resp, sizeof(ack_resp)))
+    {
+        return false;
+    }
+    waitFor("OK", "ERROR", 500);
+    
+    unsigned long txlen, acklen, nacklen;
+    if(3 != sscanf(ack_resp, "%lu,%lu,%lu", &txlen, &acklen, &nacklen))
+    {
+        return false;
+    }
+    
+    qsend_unacked = nacklen;
+    qsend_pending = 0;
+    
+    // Any acknowledgement, or a new connection resetting the counts, is
+    // progress
+    if(acklen != qsend_acked || nacklen == 0)
+    {
+        qsend_acked = acklen;
+        qsend_progress = millis();
+    }
+    else if((millis() - qsend_progress) > TR_QSEND_STALL)
+    {
+        qsend_failures++;
+        qsend_progress = millis();
+        Serial.print("Quick send stalled with unacknowledged bytes: ");
+        Serial.println(nacklen);
+        if(send_failure_callback != NULL)
+        {
+            send_failure_callback(nacklen);
+        }
+    }
+    
+    return true;
+}
+
+uint32_t TR_SIM7000::getInFlight(void)
+{
+    return qsend_unacked + qsend_pending;
+}
+
+void TR_SIM7000::setSendFailureCallback(void (*callback)(uint32_t unacked))
+{
+    send_failure_callback = callback;
+}
+
+uint32_t TR_SIM7000::getSendFailures(void)
+{
+    return qsend_failures;
+}
+
+bool TR_SIM7000::setKeepAlive(bool enable,
+                              uint16_t idle,
+                              uint16_t interval,
+                              uint8_t count)
+{
+    if(tcp_stack == eCA)
+    {
+        return false;
+    }
+    
+    char tka_command[40];
+    if(enable)
+    {
+        sprintf(tka_command, "AT+CIPTKA=1,%u,%u,%u\r\n", idle, interval, count);
+    }
+    else
+    {
+        strcpy(tka_command, "AT+CIPTKA=0\r\n");
+    }
+    return checkSendCmd(tka_command,"OK");
+}
+
+void TR_SIM7000::setInactivityTimeout(uint32_t timeout)
+{
+    inactivity_timeout = timeout;
+    last_rx = millis();
+}
+
+void TR_SIM7000::setLinkCallback(void (*callback)(eLink reason))
+{
+    link_callback = callback;
+}
+
+TR_SIM7000::eLink TR_SIM7000::checkLink(void)
+{
+    if(link_state == eLinkUp && inactivity_timeout > 0 &&
+       (millis() - last_rx) > inactivity_timeout)
+    {
+        setLinkDown(eLinkIdle);
+    }
+    return link_state;
+}
+
+bool TR_SIM7000::reconnect(void)
+{
+    Serial.println("Reconnecting to caster ...");
+    
+    if(link_state == eLinkDeact)
+    {
+        // The PDP context is gone, tear down and attach again
+        closeNetwork();
+        if(!attachService())
+        {
+            return false;
+        }
+    }
+    else
+    {
+        closeConnection();
+    }
+    
+    return establishTCPConnectionClient();
+}
+
+void TR_SIM7000::scanURC(char c)
+{
+    // Socket data framed as +IPD,<length>:<data> when headers are enabled
+    if(c == ':' && rx_stash != NULL && urc_len > 5 && 0 == strncmp(urc_line, "+IPD,", 5))
+    {
+        urc_line[urc_len] = '\0';
+        ipd_remaining = atoi(urc_line + 5);
+        urc_len = 0;
+        return;
+    }
+    
+    if(c == '\n')
+    {
+        // Only the start of each line is kept, strip the carriage return
+        uint8_t len = urc_len;
+        if(len > 0 && urc_line[len - 1] == '\r')
+        {
+            len--;
+        }
+        urc_line[len] = '\0';
+        urc_len = 0;
+        
+        if(0 == strncmp(urc_line, "+CEREG: ", 8))
+        {
+            parseRegistration(urc_line + 8);
+        }
+        else if(0 == strncmp(urc_line, "+CDNSGIP: ", 10))
+        {
+            parseDNS(urc_line + 10);
+        }
+        else if(0 == strcmp(urc_line, "+CIPRXGET: 1") ||
+                (tcp_stack == eCA && 0 == strncmp(urc_line, "+CADATAIND: ", 12)))
+        {
+            // New data is waiting in the SIM7000
+            rx_ready = true;
+        }
+        else if(0 == strcmp(urc_line, "CLOSED"))
+        {
+            setLinkDown(eLinkClosed);
+        }
+        else if(0 == strncmp(urc_line, "+PDP: DEACT", 11) ||
+                0 == strncmp(urc_line, "+APP PDP: DEACTIVE", 18))
+        {
+            setLinkDown(eLinkDeact);
+        }
+        else if(tcp_stack == eCA && 0 == strncmp(urc_line, "+CASTATE: ", 10))
+        {
+            // +CASTATE: <cid>,0 reports the connection was closed
+            char *comma = strchr(urc_line, ',');
+            if(comma != NULL && comma[1] == '0' && atoi(urc_line + 10) == ca_cid)
+            {
+                setLinkDown(eLinkClosed);
+            }
+        }
+        return;
+    }
+    
+    if(urc_len < sizeof(urc_line) - 1)
+    {
+        urc_line[urc_len++] = c;
+    }
+}
+
+void TR_SIM7000::setLinkDown(eLink reason)
+{
+    if(link_state != eLinkUp || link_quiet)
+    {
+        return;
+    }
+    
+    link_state = reason;
+    Serial.print("Caster link lost: ");
+    if(reason == eLinkClosed)
+        Serial.println("connection closed");
+    else if(reason == eLinkDeact)
+        Serial.println("PDP context deactivated");
+    else
+        Serial.println("no data received");
+    
+    if(link_callback != NULL)
+    {
+        link_callback(reason);
+    }
+}
+
+void TR_SIM7000::setLinkUp(void)
+{
+    link_state = eLinkUp;
+    last_rx = millis();
+}
+
+bool TR_SIM7000::setPSM(bool enable,
+                        const char* tau,
+                        const char* active_time)
+{
+    char psm_command[48];
+    if(enable)
+    {
+        sprintf(psm_command, "AT+CPSMS=1,,,\"%s\",\"%s\"\r\n", tau, active_time);
+    }
+    else
+    {
+        strcpy(psm_command, "AT+CPSMS=0\r\n");
+    }
+    return checkSendCmd(psm_command,"OK");
+}
+
+bool TR_SIM7000::setEDRX(bool enable, eNet net, const char* cycle)
+{
+    char edrx_command[32];
+    if(!enable)
+    {
+        return checkSendCmd("AT+CEDRXS=0\r\n","OK");
+    }
+    
+    // Access technology 4 is CAT-M (selected by CMNB=1), 2 is GSM
+    int act = (net == eNB) ? 4 : 2;
+    sprintf(edrx_command, "AT+CEDRXS=1,%d,\"%s\"\r\n", act, cycle);
+    return checkSendCmd(edrx_command,"OK");
+}
+
+bool TR_SIM7000::setDTRPin(int dtr_pin)
+{
+    DTR = dtr_pin;
+    pinMode(DTR,OUTPUT);
+    digitalWrite(DTR, LOW);
+    delay(50);
+    
+    // Allow the SIM7000 to sleep its UART while DTR is high
+    return checkSendCmd("AT+CSCLK=1\r\n","OK");
+}
+
+bool TR_SIM7000::wake(void)
+{
+    // Pulling DTR low brings the UART out of sleep
+    if(DTR >= 0)
+    {
+        digitalWrite(DTR, LOW);
+        delay(50);
+    }
+    
+    if(checkSendCmd("AT\r\n","OK",100))
+    {
+        return true;
+    }
+    
+    // No response so the SIM7000 is in PSM, a short power key pulse wakes it
+    // while keeping the registration and PDP context. Holding the key for
+    // over a second as in turnON() would power the module down instead.
+    pinMode(PWRKEY,OUTPUT);
+    digitalWrite(PWRKEY, LOW);
+    delay(100);
+    digitalWrite(PWRKEY, HIGH);
+    
+    uint32_t start = millis();
+    while((millis() - start) < 5000)
+    {
+        if(checkSendCmd("AT\r\n","OK",100))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TR_SIM7000::sleep(void)
+{
+    // With PSM enabled the SIM7000 enters PSM on its own once the active
+    // timer expires, releasing DTR lets the UART sleep until then
+    if(DTR >= 0)
+    {
+        digitalWrite(DTR, HIGH);
+    }
+}
+
+bool TR_SIM7000::wakeSendSleep(char *buf, size_t len, uint32_t &latency)
+{
+    uint32_t start = millis();
+    
+    if(!wake())
+    {
+        // Release DTR so a SIM7000 that woke late can still sleep
+        sleep();
+        return false;
+    }
+    
+    // Registration is normally retained through PSM, allow a short window
+    // for the SIM7000 to report it again
+    while(!isRegistered())
+    {
+        if((millis() - start) > 10000)
+        {
+            sleep();
+            return false;
+        }
+        delay(100);
+    }
+    
+    // PDP context survives PSM but the caster may have dropped the socket
+    if(!checkTCP() && !openConnection())
+    {
+        sleep();
+        return false;
+    }
+    
+    bool sent = send(buf, len);
+    latency = millis() - start;
+    last_wake_latency = latency;
+    
+    sleep();
+    return sent;
+}
+
+uint32_t TR_SIM7000::getWakeLatency(void)
+{
+    return last_wake_latency;
+}
+
+bool TR_SIM7000::startCmd(const char* cmd,
+                          const char* resp,
+                          const char* err,
+                          uint32_t timeout)
+{
+    // Responses to a receive request may still be arriving
+    if(cmd_pending || pull_state != ePullIdle)
+    {
+        return false;
+    }
+    
+    expectCmd(resp, err, timeout);
+    sendCmd(cmd);
+    return true;
+}
+
+void TR_SIM7000::expectCmd(const char* resp,
+                           const char* err,
+                           uint32_t timeout)
+{
+    async_resp = resp;
+    async_err = err;
+    async_timeout = timeout;
+    async_len = 0;
+    async_start = millis();
+    cmd_pending = true;
+}
+
+TR_SIM7000::eCmd TR_SIM7000::pollCmd(void)
+{
+    if(!cmd_pending)
+    {
+        return eCmdIdle;
+    }
+    
+    // Only consume what has already arrived
+    char c;
+    while(readChar(c))
+    {
+        pushWindow(async_window, async_len, sizeof(async_window), c);
+        
+        if(windowEndsWith(async_window, async_len, async_resp))
+        {
+            cmd_pending = false;
+            return eCmdOK;
+        }
+        if((async_err != NULL && windowEndsWith(async_window, async_len, async_err)) ||
+           windowEndsWith(async_window, async_len, "ERROR"))
+        {
+            cmd_pending = false;
+            return eCmdFail;
+        }
+    }
+    
+    if((millis() - async_start) > async_timeout)
+    {
+        cmd_pending = false;
+        return eCmdFail;
+    }
+    return eCmdPending;
+}
+
+uint16_t TR_SIM7000::readAvailable(char *buff, uint16_t maxlen)
+{
+    uint32_t arrival = millis();
+    uint16_t len = readSocket(buff, maxlen);
+    recordRx(buff, len, arrival);
+    return len;
+}
+
+uint16_t TR_SIM7000::readSocket(char *buff, uint16_t maxlen)
+{
+    // Transparent data channel carries nothing but socket data
+    if(data_port != NULL)
+    {
+        uint16_t i = 0;
+        while(i < maxlen && data_port->available())
+        {
+            buff[i++] = (char)data_port->read();
+        }
+        return i;
+    }
+    
+    // Data held by the SIM7000 has to be requested
+    if(tcp_stack == eCA || manual_rx)
+    {
+        return pullAvailable(buff, maxlen);
+    }
+    
+    uint16_t i = 0;
+    if(rx_stash != NULL)
+    {
+        // Data kept while a command ran is older than anything unread
+        while(i < maxlen && stash_count > 0)
+        {
+            buff[i++] = rx_stash[stash_head];
+            stash_head = (stash_head + 1) % stash_size;
+            stash_count--;
+        }
+        
+        // The rest of the line belongs to the pending command
+        if(cmd_pending)
+        {
+            return i;
+        }
+        
+        while(i < maxlen && sim7000Serial->available())
+        {
+            char c = (char)sim7000Serial->read();
+            if(ipd_remaining > 0)
+            {
+                buff[i++] = c;
+                ipd_remaining--;
+            }
+            else
+            {
+                scanURC(c);
+            }
+        }
+        return i;
+    }
+    
+    // Without headers socket data cannot be told apart from a response
+    if(cmd_pending)
+    {
+        return 0;
+    }
+    
+    while(i < maxlen && sim7000Serial->available())
+    {
+        buff[i] = (char)sim7000Serial->read();
+        scanURC(buff[i++]);
+    }
+    return i;
+}
+
+uint16_t TR_SIM7000::pullAvailable(char *buff, uint16_t maxlen)
+{
+    if(pull_state == ePullIdle)
+    {
+        if(cmd_pending)
+        {
+            return 0;
+        }
+        
+        // Request data once the SIM7000 reports some, polling in case a
+        // report was missed
+        char c;
+        while(readChar(c));
+        if(!rx_ready && (millis() - pull_last) < TR_PULL_INTERVAL)
+        {
+            return 0;
+        }
+        
+        // CARECV and CIPRXGET accept at most 1460 bytes per request
+        pull_request = (maxlen > 1460) ? 1460 : maxlen;
+        if(pull_request == 0)
+        {
+            return 0;
+        }
+        
+        // Response is +CARECV: <len>,<data> or +CARECV: 0, and
+        // +CIPRXGET: 2,<reqlength>,<cnflength> followed by the data
+        char pull_command[32];
+        if(tcp_stack == eCA)
+        {
+            sprintf(pull_command, "AT+CARECV=%d,%d\r\n", ca_cid, pull_request);
+            startCmd(pull_command, "+CARECV: ", "ERROR", 1000);
+        }
+        else
+        {
+            sprintf(pull_command, "AT+CIPRXGET=2,%d\r\n", pull_request);
+            startCmd(pull_command, "+CIPRXGET: 2,", "ERROR", 1000);
+        }
+        rx_ready = false;
+        pull_len = 0;
+        pull_remaining = 0;
+        pull_state = ePullHeader;
+    }
+    
+    uint16_t i = 0;
+    while(pull_state != ePullIdle)
+    {
+        if(pull_state == ePullHeader || pull_state == ePullEnd)
+        {
+            eCmd result = pollCmd();
+            if(result == eCmdPending)
+            {
+                break;
+            }
+            if(pull_state == ePullHeader && result == eCmdOK)
+            {
+                pull_state = ePullLength;
+                pull_progress = millis();
+                continue;
+            }
+            
+            // Request complete or failed
+            pull_state = ePullIdle;
+            pull_last = millis();
+            break;
+        }
+        
+        if(!sim7000Serial->available())
+        {
+            if((millis() - pull_progress) > 500)
+            {
+                Serial.println("Receive request timed out");
+                pull_state = ePullIdle;
+                pull_last = millis();
+            }
+            break;
+        }
+        
+        if(pull_state == ePullData)
+        {
+            if(i == maxlen)
+            {
+                break;
+            }
+            buff[i++] = (char)sim7000Serial->read();
+            pull_progress = millis();
+            if(--pull_len == 0)
+            {
+                expectCmd("OK", "ERROR", 500);
+                pull_state = ePullEnd;
+            }
+            continue;
+        }
+        
+        char c = (char)sim7000Serial->read();
+        pull_progress = millis();
+        if(c >= '0' && c <= '9')
+        {
+            if(pull_state == ePullLength)
+            {
+                pull_len = (pull_len * 10) + (c - '0');
+            }
+            else
+            {
+                pull_remaining = (pull_remaining * 10) + (c - '0');
+            }
+            continue;
+        }
+        
+        if(pull_state == ePullLength && tcp_stack != eCA)
+        {
+            if(c == ',')
+            {
+                pull_state = ePullRemaining;
+            }
+            continue;
+        }
+        if(pull_state == ePullRemaining && c != '\n')
+        {
+            continue;
+        }
+        
+        // A full read may have left more data in the SIM7000
+        if(pull_len > pull_request)
+        {
+            pull_len = pull_request;
+        }
+        rx_ready = (tcp_stack == eCA) ? (pull_len == pull_request) : (pull_remaining > 0);
+        if(pull_len > 0)
+        {
+            pull_state = ePullData;
+        }
+        else
+        {
+            expectCmd("OK", "ERROR", 500);
+            pull_state = ePullEnd;
+        }
+    }
+    return i;
+}
+
+bool TR_SIM7000::setReceiveBuffer(char *buffer, uint16_t size)
+{
+    if(buffer == NULL || size == 0)
+    {
+        buffer = NULL;
+        size = 0;
+    }
+    
+    if(!checkSendCmd((buffer != NULL) ? "AT+CIPHEAD=1\r\n" : "AT+CIPHEAD=0\r\n", "OK"))
+    {
+        Serial.println("Failed to set data headers");
+        return false;
+    }
+    
+    rx_stash = buffer;
+    stash_size = size;
+    stash_head = 0;
+    stash_count = 0;
+    ipd_remaining = 0;
+    return true;
+}
+
+uint32_t TR_SIM7000::getReceiveOverflows(void)
+{
+    return stash_overflows;
+}
+
+bool TR_SIM7000::setGNSSPower(bool on)
+{
+    return checkSendCmd(on ? "AT+CGNSPWR=1\r\n" : "AT+CGNSPWR=0\r\n","OK");
+}
+
+bool TR_SIM7000::setGNSSPort(uint8_t port)
+{
+    char cfg_command[24];
+    sprintf(cfg_command, "AT+CGNSCFG=%d\r\n", port);
+    return checkSendCmd(cfg_command,"OK");
+}
+
+bool TR_SIM7000::setGNSSStream(bool enable)
+{
+    return checkSendCmd(enable ? "AT+CGNSTST=1\r\n" : "AT+CGNSTST=0\r\n","OK");
+}
+
+bool TR_SIM7000::sendGNSSCommand(const char* sentence)
+{
+    uint8_t checksum = 0;
+    for(const char *c = sentence; *c != '\0'; c++)
+    {
+        checksum ^= (uint8_t)*c;
+    }
+    
+    char gnss_command[96];
+    int len = snprintf(gnss_command, sizeof(gnss_command),
+                       "AT+CGNSCMD=0,\"$%s*%02X\"\r\n", sentence, checksum);
+    if(len < 0 || len >= (int)sizeof(gnss_command))
+    {
+        return false;
+    }
+    return checkSendCmd(gnss_command,"OK");
+}
+
+bool TR_SIM7000::setGNSSRate(uint16_t period)
+{
+    char rate_sentence[16];
+    sprintf(rate_sentence, "PMTK220,%u", period);
+    return sendGNSSCommand(rate_sentence);
+}
+
+uint8_t TR_SIM7000::readGNSS(TR_NMEAParser &parser)
+{
+    // The line belongs to the pending command or receive request
+    if(cmd_pending || pull_state != ePullIdle)
+    {
+        return 0;
+    }
+    
+    // Read through readChar() so URCs and +IPD data are still handled
+    char chunk[64];
+    uint8_t updates = 0;
+    uint16_t len;
+    do
+    {
+        char c;
+        len = 0;
+        while(len < sizeof(chunk) && readChar(c))
+        {
+            chunk[len++] = c;
+        }
+        updates += parser.feed(chunk, len);
+    }
+    while(len == sizeof(chunk));
+    
+    return updates;
+}
+
+void TR_SIM7000::setLatencyMonitor(TR_LatencyMonitor *monitor)
+{
+    latency = monitor;
+}
+
+bool TR_SIM7000::syncClock(TR_LatencyMonitor &monitor, const char* ntp_server)
+{
+    if(ntp_server != NULL)
+    {
+        // Set the clock to UTC from the server
+        char ntp_command[96];
+        int len = snprintf(ntp_command, sizeof(ntp_command), 
+                           "AT+CNTP=\"%s\",0\r\n", ntp_server);
+        if(len < 0 || len >= (int)sizeof(ntp_command) || 
+           !checkSendCmd(ntp_command,"OK"))
+        {
+            return false;
+        }
+        sendCmd("AT+CNTP\r\n");
+        if(!waitFor("+CNTP: 1", "+CNTP: 6", 10000))
+        {
+            Serial.println("NTP synchronisation failed");
+            return false;
+        }
+    }
+    
+    uint32_t date;
+    uint32_t local_time;
+    int zone;
+    if(!readClock(date, local_time, zone))
+    {
+        return false;
+    }
+    
+    // The clock only has whole seconds, use the moment they change
+    uint32_t first_second = local_time;
+    uint32_t start = millis();
+    while((millis() - start) < 1500)
+    {
+        uint32_t sent = millis();
+        if(!readClock(date, local_time, zone))
+        {
+            return false;
+        }
+        if(local_time != first_second)
+        {
+            monitor.setClockUTC(date, local_time, sent);
+            if(zone != 0)
+            {
+                const int32_t week = 604800000L;
+                int32_t tow = (int32_t)monitor.getTOW(sent) - zone * 900000L;
+                monitor.setClock((uint32_t)((tow + week) % week), sent);
+            }
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+bool TR_SIM7000::readClock(uint32_t &date, uint32_t &local_time, int &zone)
+{
+    // Response is +CCLK: "yy/MM/dd,hh:mm:ss+zz"
+    char clock_resp[32];
+    sendCmd("AT+CCLK?\r\n");
+    if(!waitFor("+CCLK: \"", "ERROR") || !readLine(clock_resp, sizeof(clock_resp)))
+    {
+        return false;
+    }
+    waitFor("OK", "ERROR", 500);
+    
+    int year, month, day, hours, minutes, seconds;
+    if(7 != sscanf(clock_resp, "%2d/%2d/%2d,%2d:%2d:%2d%3d", 
+                   &year, &month, &day, &hours, &minutes, &seconds, &zone))
+    {
+        return false;
+    }
+    
+    date = (uint32_t)day * 10000 + month * 100 + year;
+    local_time = ((uint32_t)hours * 3600 + minutes * 60 + seconds) * 1000;
+    return true;
+}
+
+bool TR_SIM7000::mqttConfig(const char* broker,
+                            int port,
+                            const char* client_id,
+                            const char* username,
+                            const char* password,
+                            uint16_t keepalive)
+{
+    char mqtt_command[128];
+    
+    sprintf(mqtt_command, "AT+SMCONF=\"URL\",\"%s\",%d\r\n", broker, port);
+    if(!checkSendCmd(mqtt_command,"OK"))
+    {
+        return false;
+    }
+    
+    sprintf(mqtt_command, "AT+SMCONF=\"CLIENTID\",\"%s\"\r\n", client_id);
+    if(!checkSendCmd(mqtt_command,"OK"))
+    {
+        return false;
+    }
+    
+    sprintf(mqtt_command, "AT+SMCONF=\"KEEPTIME\",%d\r\n", keepalive);
+    if(!checkSendCmd(mqtt_command,"OK"))
+    {
+        return false;
+    }
+    
+    if(!checkSendCmd("AT+SMCONF=\"CLEANSS\",1\r\n","OK"))
+    {
+        return false;
+    }
+    
+    if(username != NULL)
+    {
+        sprintf(mqtt_command, "AT+SMCONF=\"USERNAME\",\"%s\"\r\n", username);
+        if(!checkSendCmd(mqtt_command,"OK"))
+        {
+            return false;
+        }
+    }
+    
+    if(password != NULL)
+    {
+        sprintf(mqtt_command, "AT+SMCONF=\"PASSWORD\",\"%s\"\r\n", password);
+        if(!checkSendCmd(mqtt_command,"OK"))
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool TR_SIM7000::mqttConnect(void)
+{
+    Serial.print("Connecting to MQTT broker ... ");
+    sendCmd("AT+SMCONN\r\n");
+    mqtt_connected = waitFor("OK", "ERROR", 30000);
+    if(!mqtt_connected)
+    {
+        Serial.println("Failed to connect");
+        return false;
+    }
+    Serial.println("Connected");
+    
+    // Deliver anything queued while disconnected
+    mqttFlush();
+    return true;
+}
+
+bool TR_SIM7000::mqttDisconnect(void)
+{
+    mqtt_connected = false;
+    return checkSendCmd("AT+SMDISC\r\n","OK");
+}
+
+bool TR_SIM7000::mqttConnected(void)
+{
+    mqtt_connected = checkSendCmd("AT+SMSTATE?\r\n","+SMSTATE: 1");
+    return mqtt_connected;
+}
+
+void TR_SIM7000::setMQTTBatch(bool enable, char separator)
+{
+    mqtt_batch = enable;
+    mqtt_separator = separator;
+}
+
+bool TR_SIM7000::mqttPublish(const char* topic,
+                             const char* payload,
+                             uint16_t len,
+                             uint8_t qos,
+                             bool retain)
+{
+    if(len > TR_MQTT_PAYLOAD_MAX || strlen(topic) >= TR_MQTT_TOPIC_MAX)
+    {
+        return false;
+    }
+    
+    // Publish straight away unless batching or older messages are waiting
+    if(mqtt_connected && !mqtt_batch && mqtt_count == 0)
+    {
+        if(mqttPublishNow(topic, payload, len, qos, retain))
+        {
+            return true;
+        }
+        mqtt_connected = false;
+    }
+    
+    if(mqtt_size == 0)
+    {
+        Serial.println("No MQTT queue set");
+        return false;
+    }
+    if(mqtt_count == mqtt_size)
+    {
+        Serial.println("MQTT queue full");
+        return false;
+    }
+    
+    mqttMessage *message = &mqtt_queue[(mqtt_head + mqtt_count) % mqtt_size];
+    strcpy(message->topic, topic);
+    memcpy(message->payload, payload, len);
+    message->len = len;
+    message->qos = qos;
+    message->retain = retain;
+    mqtt_count++;
+    
+    return true;
+}
+
+void TR_SIM7000::setMQTTQueue(mqttMessage *queue, uint8_t size)
+{
+    mqtt_queue = (size > 0) ? queue : NULL;
+    mqtt_size = (queue != NULL) ? size : 0;
+    mqtt_head = 0;
+    mqtt_count = 0;
+}
+
+uint8_t TR_SIM7000::mqttFlush(void)
+{
+    uint8_t published = 0;
+    
+    // One connection check covers the whole batch
+    if(mqtt_count == 0 || !mqtt_connected)
+    {
+        return 0;
+    }
+    
+    while(mqtt_count > 0)
+    {
+        mqttMessage *message = &mqtt_queue[mqtt_head];
+        uint8_t messages = 1;
+        
+        // Join following messages for the same topic into one publish
+        if(mqtt_separator != '\0')
+        {
+            while(messages < mqtt_count)
+            {
+                mqttMessage *next = &mqtt_queue[(mqtt_head + messages) % mqtt_size];
+                if(0 != strcmp(next->topic, message->topic) ||
+                   next->qos != message->qos ||
+                   next->retain != message->retain ||
+                   (message->len + 1 + next->len) > TR_MQTT_PAYLOAD_MAX)
+                {
+                    break;
+                }
+                message->payload[message->len++] = mqtt_separator;
+                memcpy(message->payload + message->len, next->payload, next->len);
+                message->len += next->len;
+                messages++;
+            }
+        }
+        
+        if(!mqttPublishNow(message->topic, message->payload, message->len,
+                           message->qos, message->retain))
+        {
+            // Joined messages stay joined and are retried as one
+            mqtt_head = (mqtt_head + messages - 1) % mqtt_size;
+            mqtt_count -= messages - 1;
+            if(messages > 1)
+            {
+                mqtt_queue[mqtt_head] = *message;
+            }
+            mqtt_connected = false;
+            break;
+        }
+        
+        mqtt_head = (mqtt_head + messages) % mqtt_size;
+        mqtt_count -= messages;
+        published += messages;
+    }
+    
+    return published;
+}
+
+uint8_t TR_SIM7000::mqttQueued(void)
+{
+    return mqtt_count;
+}
+
+bool TR_SIM7000::mqttSubscribe(const char* topic, uint8_t qos)
+{
+    char mqtt_command[96];
+    sprintf(mqtt_command, "AT+SMSUB=\"%s\",%d\r\n", topic, qos);
+    return checkSendCmd(mqtt_command,"OK",5000);
+}
+
+bool TR_SIM7000::mqttUnsubscribe(const char* topic)
+{
+    char mqtt_command[96];
+    sprintf(mqtt_command, "AT+SMUNSUB=\"%s\"\r\n", topic);
+    return checkSendCmd(mqtt_command,"OK",5000);
+}
+
+bool TR_SIM7000::mqttRecv(char *topic,
+                          uint16_t topic_len,
+                          char *payload,
+                          uint16_t &payload_len,
+                          uint32_t timeout)
+{
+    // Messages arrive as +SMSUB: "<topic>","<payload>"
+    if(!waitFor("+SMSUB: \"", NULL, timeout))
+    {
+        return false;
+    }
+    
+    uint16_t i = 0;
+    uint32_t timecnt = millis();
+    while((millis() - timecnt) < 1000)
+    {
+        char c;
+        if(!readChar(c))
+        {
+            continue;
+        }
+        if(c == '"')
+        {
+            break;
+        }
+        if(i < topic_len - 1)
+        {
+            topic[i++] = c;
+        }
+    }
+    topic[i] = '\0';
+    
+    if(!waitFor(",\"", NULL, 1000))
+    {
+        return false;
+    }
+    
+    // Payload runs to the closing quote at the end of the line
+    uint16_t max_len = payload_len;
+    i = 0;
+    timecnt = millis();
+    while((millis() - timecnt) < 1000)
+    {
+        char c;
+        if(!readChar(c))
+        {
+            continue;
+        }
+        timecnt = millis();
+        if(c == '\n' && i > 0 && payload[i - 1] == '\r')
+        {
+            i--;
+            break;
+        }
+        if(i < max_len)
+        {
+            payload[i++] = c;
+        }
+    }
+    if(i > 0 && payload[i - 1] == '"')
+    {
+        i--;
+    }
+    payload_len = i;
+    
+    return true;
+}
+
+bool TR_SIM7000::closeNetwork(void)
+{
+    if(tcp_stack == eCA)
+    {
+        // Closing a connection that is not open returns ERROR, only the
+        // PDP context deactivation result is reported
+        char close_command[20];
+        sprintf(close_command, "AT+CACLOSE=%d\r\n", ca_cid);
+        checkSendCmd(close_command,"OK");
+        return checkSendCmd("AT+CNACT=0\r\n","OK",2000);
+    }
+    
+    if(checkSendCmd("AT+CIPSHUT\r\n","OK",2000))
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool TR_SIM7000::isRegistered(void)
+{
+    // The response passes through scanURC(), which updates reg_state,
+    // so a reply must have been parsed for reg_state to be current
+    uint32_t reports = reg_reports;
+    sendCmd("AT+CEREG?\r\n");
+    if(!waitFor("OK", "ERROR") || reg_reports == reports)
+    {
+        return false;
+    }
+    
+    return (reg_state == eRegHome || reg_state == eRegRoaming);
+}
+
+bool TR_SIM7000::probe(void)
+{
+    // Discard anything left over from before the reset
+    while(sim7000Serial->available())
+    {
+        sim7000Serial->read();
+    }
+    
+    for(uint8_t count = 0; count < 3; count++)
+    {
+        if(checkSendCmd("AT\r\n","OK",100))
+        {
+            return true;
+        }
+    }
+    
+    // A multiplexer left running ignores plain AT commands, send a close
+    // down on the control channel
+    const uint8_t cmux_close[] = {0xF9, 0x03, 0xEF, 0x05, 0xC3, 0x01, 0xF2, 0xF9};
+    sim7000Serial->write(cmux_close, sizeof(cmux_close));
+    delay(100);
+    if(checkSendCmd("AT\r\n","OK",100))
+    {
+        return true;
+    }
+    
+    // A transparent connection needs the escape sequence with guard time
+    delay(1000);
+    sendCmd("+++");
+    delay(1000);
+    return checkSendCmd("AT\r\n","OK",100);
+}
+
+bool TR_SIM7000::queryIPAddress(void)
+{
+    char ip_resp[48];
+    cleanBuffer(ip_resp, 48);
+    ip_address[0] = '\0';
+    
+    if(tcp_stack == eCA)
+    {
+        // Response is +CNACT: <status>,"<ip>"
+        sendCmd("AT+CNACT?\r\n");
+        readBuffer(ip_resp, 47, 100);
+        char *start = strstr(ip_resp, "+CNACT: 1,\"");
+        if(start == NULL)
+        {
+            return false;
+        }
+        start += 11;
+        char *end = strchr(start, '"');
+        if(end == NULL || (end - start) >= (int)sizeof(ip_address))
+        {
+            return false;
+        }
+        memcpy(ip_address, start, end - start);
+        ip_address[end - start] = '\0';
+        return true;
+    }
+    
+    // CIFSR returns the bare address, or ERROR without a PDP context
+    sendCmd("AT+CIFSR\r\n");
+    readBuffer(ip_resp, 47, 100);
+    if(NULL != strstr(ip_resp, "ERROR"))
+    {
+        return false;
+    }
+    
+    uint8_t len = 0;
+    for(uint8_t i = 0; ip_resp[i] != '\0'; i++)
+    {
+        char c = ip_resp[i];
+        if((c >= '0' && c <= '9') || c == '.')
+        {
+            if(len < sizeof(ip_address) - 1)
+            {
+                ip_address[len++] = c;
+            }
+        }
+        else if(len > 0)
+        {
+            break;
+        }
+    }
+    ip_address[len] = '\0';
+    
+    return (len >= 7);
+}
+
+bool TR_SIM7000::openConnection(void)
+{
+    // A lookup needs the CA stack's PDP context
+    if(tcp_stack == eCA && !activateCAContext())
+    {
+        return false;
+    }
+    
+    // Connect by cached address to skip the modem's lookup, unless a
+    // refresh after a failure is still running
+    char ip[16];
+    dnsEntry *entry = findDNS(host, false);
+    bool by_address = !(entry != NULL && dnsPending(entry)) && resolveHost(host, ip);
+    const char *target = by_address ? ip : host;
+    
+    bool opened = (tcp_stack == eCA) ? openCAConnection(target) : openCIPConnection(target);
+    
+    if(!opened && by_address && 0 != strcmp(ip, host))
+    {
+        // The address may have moved, look it up again in the background
+        entry = findDNS(host, false);
+        if(entry != NULL)
+        {
+            entry->valid = false;
+        }
+        refreshDNS(host);
+    }
+    
+    if(opened)
+    {
+        setLinkUp();
+    }
+    return opened;
+}
+
+bool TR_SIM7000::addCaster(const char* host_in,
+                           int port_in,
+                           const char* mntpnt_in,
+                           const char* user_in,
+                           const char* password_in)
+{
+    if(caster_count >= TR_CASTER_MAX)
+    {
+        return false;
+    }
+    
+    casterSource &caster = casters[caster_count++];
+    memset(&caster, 0, sizeof(caster));
+    caster.host = host_in;
+    caster.port = port_in;
+    caster.mntpnt = mntpnt_in;
+    caster.user = user_in;
+    caster.password = password_in;
+    caster.healthy = true;
+    return true;
+}
+
+int8_t TR_SIM7000::probeCasters(void)
+{
+    // The SIM7000 has one socket for the probes
+    if(active_caster >= 0)
+    {
+        Serial.println("Closing caster connection for probing");
+        closeConnection();
+        active_caster = -1;
+        awaiting_first = false;
+    }
+    
+    for(uint8_t i = 0; i < caster_count; i++)
+    {
+        casterSource &caster = casters[i];
+        if(!caster.healthy && (millis() - caster.failed_at) < TR_CASTER_RETRY)
+        {
+            continue;
+        }
+        
+        Serial.print("Probing caster ");Serial.println(caster.host);
+        selectCaster(i);
+        caster.attempts++;
+        uint32_t start = millis();
+        if(!establishTCPConnectionClient())
+        {
+            casterFailed(i);
+            closeConnection();
+            continue;
+        }
+        uint32_t answered = millis();
+        recordLatency(caster.connect_time, caster.worst_connect, answered - start);
+        
+        if(waitFirstByte(TR_CASTER_STALL))
+        {
+            recordLatency(caster.first_byte, caster.worst_first_byte, millis() - answered);
+            caster.healthy = true;
+        }
+        else
+        {
+            casterFailed(i);
+        }
+        closeConnection();
+    }
+    active_caster = -1;
+    
+    int8_t best = -1;
+    for(uint8_t i = 0; i < caster_count; i++)
+    {
+        if(casters[i].healthy && (best < 0 || casterScore(i) < casterScore(best)))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool TR_SIM7000::connectCaster(void)
+{
+    bool tried[TR_CASTER_MAX] = {false};
+    
+    for(uint8_t attempt = 0; attempt < caster_count; attempt++)
+    {
+        // Fastest caster not yet tried that is not waiting out a failure
+        int8_t next = -1;
+        for(uint8_t i = 0; i < caster_count; i++)
+        {
+            if(tried[i] || 
+               (!casters[i].healthy && (millis() - casters[i].failed_at) < TR_CASTER_RETRY))
+            {
+                continue;
+            }
+            if(next < 0 || casterScore(i) < casterScore(next))
+            {
+                next = i;
+            }
+        }
+        if(next < 0)
+        {
+            break;
+        }
+        tried[next] = true;
+        
+        casterSource &caster = casters[next];
+        Serial.print("Connecting to caster ");Serial.println(caster.host);
+        selectCaster(next);
+        caster.attempts++;
+        uint32_t start = millis();
+        if(!establishTCPConnectionClient())
+        {
+            casterFailed(next);
+            closeConnection();
+            continue;
+        }
+        
+        connected_at = millis();
+        recordLatency(caster.connect_time, caster.worst_connect, connected_at - start);
+        caster.healthy = true;
+        awaiting_first = true;
+        if(active_caster >= 0 && active_caster != next)
+        {
+            caster_switches++;
+        }
+        active_caster = next;
+        
+        if(inactivity_timeout == 0)
+        {
+            setInactivityTimeout(TR_CASTER_STALL);
+        }
+        return true;
+    }
+    
+    Serial.println("No caster available");
+    return false;
+}
+
+bool TR_SIM7000::maintainCaster(void)
+{
+    eLink state = checkLink();
+    if(active_caster >= 0 && state == eLinkUp)
+    {
+        return true;
+    }
+    
+    if(active_caster >= 0)
+    {
+        Serial.print("Caster ");Serial.print(casters[active_caster].host);
+        Serial.println(" lost, switching");
+        casters[active_caster].stalls++;
+        casterFailed(active_caster);
+    }
+    
+    if(state == eLinkDeact)
+    {
+        // The PDP context is gone, tear down and attach again
+        closeNetwork();
+        if(!attachService())
+        {
+            return false;
+        }
+    }
+    else if(active_caster >= 0)
+    {
+        closeConnection();
+    }
+    
+    return connectCaster();
+}
+
+int8_t TR_SIM7000::getActiveCaster(void)
+{
+    return active_caster;
+}
+
+uint8_t TR_SIM7000::getCasterCount(void)
+{
+    return caster_count;
+}
+
+const TR_SIM7000::casterSource& TR_SIM7000::getCaster(uint8_t index)
+{
+    return casters[index];
+}
+
+uint32_t TR_SIM7000::getCasterSwitches(void)
+{
+    return caster_switches;
+}
+
+void TR_SIM7000::printCasterStats(Print &out)
+{
+    for(uint8_t i = 0; i < caster_count; i++)
+    {
+        casterSource &caster = casters[i];
+        out.print((i == active_caster) ? "* " : "  ");
+        out.print(caster.host);out.print(":");out.print(caster.port);
+        out.print("/");out.print(caster.mntpnt);
+        out.print(caster.healthy ? " healthy" : " failed");
+        out.print(" connect=");out.print(caster.connect_time);
+        out.print("/");out.print(caster.worst_connect);
+        out.print(" first_byte=");out.print(caster.first_byte);
+        out.print("/");out.print(caster.worst_first_byte);
+        out.print(" ms attempts=");out.print(caster.attempts);
+        out.print(" failures=");out.print(caster.failures);
+        out.print(" stalls=");out.println(caster.stalls);
+    }
+    out.print("Caster switches: ");out.println(caster_switches);
+}
+
+void TR_SIM7000::selectCaster(uint8_t index)
+{
+    casterSource &caster = casters[index];
+    host = (char*)caster.host;
+    tcp_port = caster.port;
+    mntpnt = (char*)caster.mntpnt;
+    user = (char*)caster.user;
+    psw = (char*)caster.password;
+}
+
+uint32_t TR_SIM7000::casterScore(uint8_t index)
+{
+    casterSource &caster = casters[index];
+    if(caster.attempts == caster.failures)
+    {
+        return 0xFFFFFFFF;
+    }
+    return caster.connect_time + caster.first_byte;
+}
+
+void TR_SIM7000::casterFailed(uint8_t index)
+{
+    casters[index].failures++;
+    casters[index].healthy = false;
+    casters[index].failed_at = millis();
+    if(index == active_caster)
+    {
+        active_caster = -1;
+        awaiting_first = false;
+    }
+}
+
+void TR_SIM7000::recordLatency(uint32_t &smoothed, uint32_t &worst, uint32_t sample)
+{
+    // Exponentially weighted with a quarter weight on the new sample
+    smoothed = (smoothed == 0) ? sample : (smoothed * 3 + sample) / 4;
+    if(sample > worst)
+    {
+        worst = sample;
+    }
+}
+
+bool TR_SIM7000::waitFirstByte(uint32_t timeout)
+{
+    // The probe closes the connection after, so the data is dropped
+    char discard[16];
+    uint32_t start = millis();
+    while((millis() - start) < timeout)
+    {
+        uint16_t len = readSocket(discard, sizeof(discard));
+        for(uint16_t i = 0; i < len; i++)
+        {
+            // Line ends left over from the caster's reply are not data
+            if(discard[i] != '\r' && discard[i] != '\n')
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool TR_SIM7000::resolveHost(const char* name, char *ip, uint32_t timeout)
+{
+    // Addresses need no lookup
+    if(isAddress(name))
+    {
+        if(strlen(name) >= 16)
+        {
+            return false;
+        }
+        strcpy(ip, name);
+        return true;
+    }
+    
+    dnsEntry *entry = findDNS(name, false);
+    if(entry != NULL && entry->valid)
+    {
+        if((millis() - entry->resolved) > dns_ttl && !dnsPending(entry))
+        {
+            refreshDNS(name);
+        }
+        strcpy(ip, entry->ip);
+        return true;
+    }
+    
+    if(!refreshDNS(name))
+    {
+        return false;
+    }
+    
+    // The result arrives as a URC after OK
+    entry = findDNS(name, false);
+    uint32_t start = millis();
+    while(entry->pending && (millis() - start) < timeout)
+    {
+        char c;
+        readChar(c);
+    }
+    if(!entry->valid)
+    {
+        entry->pending = false;
+        Serial.print("Failed to resolve ");Serial.println(name);
+        return false;
+    }
+    
+    strcpy(ip, entry->ip);
+    return true;
+}
+
+bool TR_SIM7000::refreshDNS(const char* name)
+{
+    if(strlen(name) >= TR_DNS_HOST_MAX)
+    {
+        return false;
+    }
+    
+    // Marked first since the result can follow OK immediately
+    dnsEntry *entry = startLookup(name);
+    
+    // Only wait for OK, the result is read later as a URC
+    char dns_command[TR_DNS_HOST_MAX + 20];
+    sprintf(dns_command, "AT+CDNSGIP=\"%s\"\r\n", name);
+    sendCmd(dns_command);
+    if(!waitFor("OK", "ERROR"))
+    {
+        entry->pending = false;
+        return false;
+    }
+    return true;
+}
+
+void TR_SIM7000::setDNSTTL(uint32_t ttl)
+{
+    dns_ttl = ttl;
+}
+
+TR_SIM7000::dnsEntry* TR_SIM7000::findDNS(const char* name, bool create)
+{
+    for(uint8_t i = 0; i < TR_DNS_CACHE; i++)
+    {
+        if(0 == strcmp(dns_cache[i].host, name))
+        {
+            return &dns_cache[i];
+        }
+    }
+    
+    if(!create)
+    {
+        return NULL;
+    }
+    
+    // Entries are reused in the order they were created
+    dnsEntry *entry = &dns_cache[dns_next];
+    dns_next = (dns_next + 1) % TR_DNS_CACHE;
+    strcpy(entry->host, name);
+    entry->ip[0] = '\0';
+    entry->valid = false;
+    entry->pending = false;
+    entry->requested = 0;
+    return entry;
+}
+
+TR_SIM7000::dnsEntry* TR_SIM7000::startLookup(const char* name)
+{
+    dnsEntry *entry = findDNS(name, true);
+    entry->pending = true;
+    entry->requested = millis();
+    return entry;
+}
+
+bool TR_SIM7000::lookupDue(const char* name)
+{
+    if(isAddress(name) || strlen(name) >= TR_DNS_HOST_MAX)
+    {
+        return false;
+    }
+    
+    dnsEntry *entry = findDNS(name, false);
+    if(entry == NULL)
+    {
+        return true;
+    }
+    if(dnsPending(entry))
+    {
+        return false;
+    }
+    return !entry->valid || (millis() - entry->resolved) > dns_ttl;
+}
+
+const char* TR_SIM7000::cachedAddress(const char* name)
+{
+    // A stale address is still used while its refresh runs
+    dnsEntry *entry = findDNS(name, false);
+    return (entry != NULL && entry->valid) ? entry->ip : name;
+}
+
+bool TR_SIM7000::isAddress(const char* name)
+{
+    for(const char *c = name; *c != '\0'; c++)
+    {
+        if(!((*c >= '0' && *c <= '9') || *c == '.'))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TR_SIM7000::dnsPending(dnsEntry *entry)
+{
+    // A result that never arrives must not hold off refreshes for good
+    if(entry->pending && (millis() - entry->requested) > TR_DNS_TIMEOUT)
+    {
+        entry->pending = false;
+    }
+    return entry->pending;
+}
+
+void TR_SIM7000::parseDNS(const char *line)
+{
+    // Response is 1,"<host>","<ip>"[,"<ip2>"] or 0,<error>
+    if(line[0] != '1')
+    {
+        // Failures do not name the host, end every pending lookup
+        for(uint8_t i = 0; i < TR_DNS_CACHE; i++)
+        {
+            dns_cache[i].pending = false;
+        }
+        return;
+    }
+    
+    const char *name = strchr(line, '"');
+    const char *name_end = (name != NULL) ? strchr(name + 1, '"') : NULL;
+    const char *ip = (name_end != NULL) ? strchr(name_end + 1, '"') : NULL;
+    const char *ip_end = (ip != NULL) ? strchr(ip + 1, '"') : NULL;
+    if(ip_end == NULL || (name_end - name - 1) >= TR_DNS_HOST_MAX || 
+       (ip_end - ip - 1) >= 16)
+    {
+        return;
+    }
+    
+    char host_name[TR_DNS_HOST_MAX];
+    memcpy(host_name, name + 1, name_end - name - 1);
+    host_name[name_end - name - 1] = '\0';
+    
+    dnsEntry *entry = findDNS(host_name, true);
+    memcpy(entry->ip, ip + 1, ip_end - ip - 1);
+    entry->ip[ip_end - ip - 1] = '\0';
+    entry->resolved = millis();
+    entry->valid = true;
+    entry->pending = false;
+}
+
+bool TR_SIM7000::openCIPConnection(const char* target)
+{
+    // Create new connection
+    char start_command[96];
+    int len = snprintf(start_command, sizeof(start_command), 
+                       "AT+CIPSTART=\"TCP\",\"%s\",%d\r\n", target, tcp_port);
+    if(len < 0 || len >= (int)sizeof(start_command))
+    {
+        Serial.println("Caster host name too long");
+        return false;
+    }
+    sendCmd(start_command);
+
+    Serial.print("Establishing TCP connection ...");
+
+    // Response is OK then CONNECT OK, CONNECT FAIL or ERROR once the
+    // connection attempt ends
+    char window[16];
+    uint8_t len_window = 0;
+    uint32_t start = millis();
+    while((millis() - start) < TR_CONNECT_TIMEOUT)
+    {
+        char c;
+        if(!readChar(c))
+        {
+            continue;
+        }
+        pushWindow(window, len_window, sizeof(window), c);
+        
+        if(windowEndsWith(window, len_window, "CONNECT OK"))
+        {
+            Serial.print("Connection succesful, ");
+            return true;
+        }
+        if(windowEndsWith(window, len_window, "ERROR") || 
+           windowEndsWith(window, len_window, "CONNECT FAIL"))
+        {
+            Serial.println("Connection rejected");
+            return false;
+        }
+    }
+    
+    Serial.println("Connection timed out");
+    return false;
+}
+
+size_t TR_SIM7000::ntripRequest(char *buff, size_t maxlen)
+{
+    int len = snprintf(buff, maxlen,
+                       "GET /%s HTTP/1.0\r\n"
+                       "User-Agent: NTRIPClient for Arduino v1.0\r\n",
+                       mntpnt);
+    if(len < 0 || (size_t)len >= maxlen)
+    {
+        return 0;
     }
     
-    char gprsBuffer[32];
-    sendCmd("AT+CIPSEND\r\n");
-    cleanBuffer(gprsBuffer,32);
-    while(1)
+    if (strlen(user)==0) 
+    {
+        len += snprintf(buff + len, maxlen - len,
+                        "Accept: */*\r\n"
+                        "Connection: close\r\n");
+    }
+    else 
     {
-        readBuffer(gprsBuffer, 32);
-        if(NULL != strstr(gprsBuffer, ">"))
+        // Encode user:password in place after the header name
+        len += snprintf(buff + len, maxlen - len, "Authorization: Basic ");
+        if((size_t)len >= maxlen)
         {
-            Serial.println("Ready to send");
-            delay(100);
-            break;
+            return 0;
         }
-        else if(NULL != strstr(gprsBuffer,"ERROR"))
+        char credentials[96];
+        int cred_len = snprintf(credentials, sizeof(credentials), "%s:%s", user, psw);
+        if(cred_len < 0 || cred_len >= (int)sizeof(credentials))
         {
-            Serial.println("CIPSEND failed");
-            return false;
+            return 0;
+        }
+        size_t enc_len = base64Encode((const uint8_t*)credentials, cred_len,
+                                      buff + len, maxlen - len);
+        if(enc_len == 0)
+        {
+            return 0;
         }
+        len += enc_len;
+        len += snprintf(buff + len, maxlen - len, "\r\n");
+    }
+    if((size_t)len >= maxlen)
+    {
+        return 0;
+    }
+    len += snprintf(buff + len, maxlen - len, "\r\n");
+    if((size_t)len >= maxlen)
+    {
+        return 0;
     }
     
-    String p="GET /";
-    String auth="";
-    Serial.print("Requesting NTRIP ... ");
-    
-    p = p + mntpnt + String(" HTTP/1.0\r\n"
-        "User-Agent: NTRIPClient for Arduino v1.0\r\n"
-    );
+    return len;
+}
+
+size_t TR_SIM7000::base64Encode(const uint8_t *in, size_t in_len, 
+                                char *out, size_t maxlen)
+{
+    static const char table[] = 
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     
-    if (strlen(user)==0) 
+    size_t out_len = ((in_len + 2) / 3) * 4;
+    if(out_len >= maxlen)
     {
-        p = p + String(
-            "Accept: */*\r\n"
-            "Connection: close\r\n"
-            );
+        return 0;
     }
-    else 
+    
+    size_t j = 0;
+    for(size_t i = 0; i < in_len; i += 3)
     {
-        auth = base64::encode(String(user) + String(":") + psw);
+        uint32_t triple = (uint32_t)in[i] << 16;
+        if(i + 1 < in_len)
+            triple |= (uint32_t)in[i+1] << 8;
+        if(i + 2 < in_len)
+            triple |= in[i+2];
+        
+        out[j++] = table[(triple >> 18) & 0x3F];
+        out[j++] = table[(triple >> 12) & 0x3F];
+        out[j++] = (i + 1 < in_len) ? table[(triple >> 6) & 0x3F] : '=';
+        out[j++] = (i + 2 < in_len) ? table[triple & 0x3F] : '=';
+    }
+    out[j] = '\0';
+    
+    return out_len;
+}
 
-        p = p + String("Authorization: Basic ");
-        p = p + auth;
-        p = p + String("\r\n");
+bool TR_SIM7000::establishTransparentClient(void)
+{
+    // Run the connection commands on the data channel, it switches to
+    // transparent data once connected
+    Stream *control_port = sim7000Serial;
+    sim7000Serial = data_port;
+    
+    char start_command[96];
+    sprintf(start_command, "AT+CIPSTART=\"TCP\",\"%s\",%d\r\n", host, tcp_port);
+    sendCmd(start_command);
+    
+    Serial.print("Establishing TCP connection ...");
+    
+    if(!waitFor("CONNECT\r\n", "FAIL", TR_CONNECT_TIMEOUT))
+    {
+        Serial.println("Connection rejected");
+        sim7000Serial = control_port;
+        return false;
     }
-    p = p + String("\r\n");
+    Serial.print("Connection succesful, ");
     
-    //Serial.println(p);
-    sendCmd(p);
-    // Indicate end of write
-    sim7000Serial->write(0x1a);
+    Serial.print("Requesting NTRIP ... ");
+    char request[TR_NTRIP_REQUEST_MAX];
+    size_t request_len = ntripRequest(request, sizeof(request));
+    if(request_len == 0)
+    {
+        Serial.println("NTRIP request too long");
+        sim7000Serial = control_port;
+        return false;
+    }
+    sim7000Serial->write((const uint8_t*)request, request_len);
+    sim7000Serial = control_port;
     
-    char snip_resp[20000];
-    cleanBuffer(snip_resp, 20000);
-
-    while(1)
+    if(!readCasterReply(10000))
     {
-        while(checkReadable())
-        {
-            readBuffer(snip_resp, 20000,2000);
-            //Serial.print("snip_resp = ");Serial.println(snip_resp);
-            if(NULL != strstr(snip_resp,"ICY 200 OK"))
-            {
-                Serial.println("Received expected response from caster");
-                return true;
-            }
-            if(NULL != strstr(snip_resp,"ERROR"))
-            {
-                Serial.println("Connection rejected");
-                return false;
-            }
-        }
+        return false;
     }
+    setLinkUp();
     return true;
 }
 
-bool TR_SIM7000::establishTCPConnectionServer()
-{ 
-    // Create new connection
-    char num[4];
-    char resp[1024];
-    sendCmd("AT+CIPSTART=\"TCP\",\"");
-    sendCmd(host);
-    sendCmd("\",");
-    itoa(tcp_port, num, 10);
-    sendCmd(num);
-    sendCmd("\r\n");
+bool TR_SIM7000::sendRequest(const char *buf, size_t len)
+{
+    sendSegment segment = {buf, len};
+    return sendSegments(&segment, 1);
+}
+
+bool TR_SIM7000::sendSegments(const sendSegment *segments, uint8_t count)
+{
+    size_t total = 0;
+    for(uint8_t i = 0; i < count; i++)
+    {
+        total += segments[i].len;
+    }
+    if(total == 0 || total > TR_SEND_MAX)
+    {
+        return false;
+    }
     
-    Serial.print("Establishing TCP connection ...");
-    cleanBuffer(resp, 1024);
-    bool connection_success = false;
-    while(1)
+    bool quick = quick_send && tcp_stack == eCIP;
+    if(quick && getInFlight() + total > qsend_window)
     {
-        while(checkReadable())
+        // Refresh the estimate before refusing, the caller retries later
+        if(!updateInFlight() || getInFlight() + total > qsend_window)
         {
-            readBuffer(resp, 1024);
-            if(NULL != strstr(resp,"CONNECT OK"))
-            {
-                Serial.print("Connection succesful, ");
-                connection_success = true;
-            }
-            if(NULL != strstr(resp,"ERROR"))
-            {
-                Serial.println("Connection rejected");
-                return false;
-            }
+            return false;
         }
-        if(connection_success)
-            break;
     }
     
-    // Build the request string
-    char get1[] = "SOURCE ";
-    char get2[] = "\r\n";
-    char get3[] = "Source-Agent: AT_NTRIP v1.0\r\n";
-    char get4[] = "STR: ";
-    char get5[] = "\x1A";
-
-    char* data_to_send;
-    data_to_send = (char*)malloc(strlen(get1)+strlen(psw)+1+strlen(mntpnt)
-                                +strlen(get2)+strlen(get3)+strlen(get4)
-                                +strlen(get2)+strlen(get2));
-
-    strcpy(data_to_send, get1);
-    strcat(data_to_send, psw);
-    strcat(data_to_send, " ");
-    strcat(data_to_send, mntpnt);
-    strcat(data_to_send, get2);
-    strcat(data_to_send, get3);
-    strcat(data_to_send, get4);
-    strcat(data_to_send, get2);
-    strcat(data_to_send, info);
-    strcat(data_to_send, get2);
-    strcat(data_to_send, get5);
+    char send_command[32];
+    if(tcp_stack == eCA)
+    {
+        sprintf(send_command, "AT+CASEND=%d,%d\r\n", ca_cid, (int)total);
+    }
+    else
+    {
+        sprintf(send_command, "AT+CIPSEND=%d\r\n", (int)total);
+    }
+    sendCmd(send_command);
+    if(!waitFor(">", "ERROR"))
+    {
+        return false;
+    }
     
-    // Send the request string
-    sendCmd(data_to_send);
-    Serial.print("Sent ");
-    delay(25);
-    Serial.println(data_to_send);
+    // Length is explicit so each buffer is written verbatim in one write
+    for(uint8_t i = 0; i < count; i++)
+    {
+        sim7000Serial->write((const uint8_t*)segments[i].data, segments[i].len);
+    }
+    
+    // Stop reading as soon as the send is acknowledged so the response that
+    // follows is left for the caller
+    if(tcp_stack == eCA)
+    {
+        return waitFor("OK", "ERROR", 5000);
+    }
+    if(quick)
+    {
+        // Response is DATA ACCEPT:<length> as soon as the data is buffered
+        if(!waitFor("DATA ACCEPT:", "SEND FAIL", 5000))
+        {
+            return false;
+        }
+        uint16_t accepted = readNumber();
+        char lf;
+        readExact(&lf, 1, 100);
+        qsend_pending += accepted;
+        return accepted == total;
+    }
+    return waitFor("SEND OK", "SEND FAIL", 5000);
+}
 
-    sendCmd(data_to_send);
-    // Indicate end of write
-    sim7000Serial->write(0x1a);
+bool TR_SIM7000::closeConnection(void)
+{
+    resumed_socket = false;
     
-    Serial.println("TCP Connection Succesful\n");
+    if(tcp_stack == eCA)
+    {
+        char close_command[20];
+        sprintf(close_command, "AT+CACLOSE=%d\r\n", ca_cid);
+        return checkSendCmd(close_command,"OK");
+    }
+    
+    // Quick close, the caster has usually closed the connection already
+    return checkSendCmd("AT+CIPCLOSE=1\r\n","OK");
+}
 
+bool TR_SIM7000::activateCAContext(void)
+{
+    // Nothing to do if the PDP context is already active
+    if(checkSendCmd("AT+CNACT?\r\n","+CNACT: 1"))
+    {
+        return true;
+    }
+    
+    char cnact_command[64];
+    sprintf(cnact_command, "AT+CNACT=1,\"%s\"\r\n", APN);
+    sendCmd(cnact_command);
+    if(!waitFor("+APP PDP: ACTIVE", "ERROR", 10000))
+    {
+        Serial.println("Error activating PDP context");
+        return false;
+    }
+    Serial.print("PDP context active on APN ");
+    Serial.println(APN);
+    
     return true;
 }
 
-uint16_t TR_SIM7000::readTCP(char *buff, uint16_t maxlen)
+bool TR_SIM7000::openCAConnection(const char* target)
 {
-    uint16_t avail;
+    char ca_command[96];
+    int len = snprintf(ca_command, sizeof(ca_command), 
+                       "AT+CAOPEN=%d,\"TCP\",\"%s\",%d\r\n", ca_cid, target, tcp_port);
+    if(len < 0 || len >= (int)sizeof(ca_command))
+    {
+        Serial.println("Caster host name too long");
+        return false;
+    }
+    sendCmd(ca_command);
+    
+    Serial.print("Establishing TCP connection ...");
+    
+    // Response is +CAOPEN: <cid>,<result> with result 0 on success
+    char open_resp[8];
+    if(!waitFor("+CAOPEN: ", "ERROR", TR_CONNECT_TIMEOUT))
+    {
+        Serial.println("Connection rejected");
+        return false;
+    }
+    cleanBuffer(open_resp, 8);
+    readExact(open_resp, 3, 1000);
+    if(open_resp[2] != '0')
+    {
+        Serial.println("Connection rejected");
+        return false;
+    }
+    
+    Serial.print("Connection succesful, ");
+    return true;
+}
 
-    // Read buffer to get response
-    char gprsBuffer[maxlen];
-    cleanBuffer(gprsBuffer,maxlen);
-    int i=readBuffer(gprsBuffer,maxlen,500);
-    Serial.print("Read TCP data of length ");Serial.println(i);
+bool TR_SIM7000::mqttPublishNow(const char* topic,
+                                const char* payload,
+                                uint16_t len,
+                                uint8_t qos,
+                                bool retain)
+{
+    char mqtt_command[TR_MQTT_TOPIC_MAX + 32];
+    sprintf(mqtt_command, "AT+SMPUB=\"%s\",%d,%d,%d\r\n",
+            topic, len, qos, retain ? 1 : 0);
+    sendCmd(mqtt_command);
+    if(!waitFor(">", "ERROR"))
+    {
+        return false;
+    }
     
-    // Copy buffer to pointer passed in
-    memcpy(buff,gprsBuffer,i);
+    sim7000Serial->write((const uint8_t*)payload, len);
+    
+    // QoS 1 completes once the broker acknowledges
+    return waitFor("OK", "ERROR", (qos > 0) ? 10000 : 5000);
+}
+
+uint16_t TR_SIM7000::readCA(char *buff, uint16_t maxlen)
+{
+    // CARECV accepts at most 1460 bytes per request
+    if(maxlen > 1460)
+    {
+        maxlen = 1460;
+    }
+    
+    char recv_command[32];
+    sprintf(recv_command, "AT+CARECV=%d,%d\r\n", ca_cid, maxlen);
+    sendCmd(recv_command);
+    
+    // Response is +CARECV: <len>,<data> or +CARECV: 0 when nothing is pending
+    if(!waitFor("+CARECV: ", "ERROR"))
+    {
+        return 0;
+    }
+    
+    uint16_t len = readNumber();
+    if(len > maxlen)
+    {
+        len = maxlen;
+    }
+    
+    uint16_t i = readExact(buff, len, 500);
+    waitFor("OK", "ERROR", 500);
     
-    // Return length of data read
     return i;
 }
 
-boolean TR_SIM7000::checkTCP(void)
+uint16_t TR_SIM7000::readRXGET(char *buff, uint16_t maxlen)
 {
-    if(checkSendCmd("AT+CIPSTATUS\r\n","STATE: CONNECT OK",1000))
+    char rxget_command[32];
+    uint16_t total = 0;
+    
+    while(total < maxlen)
     {
-        return true;
+        // CIPRXGET accepts at most 1460 bytes per request
+        uint16_t request = maxlen - total;
+        if(request > 1460)
+        {
+            request = 1460;
+        }
+        
+        sprintf(rxget_command, "AT+CIPRXGET=2,%d\r\n", request);
+        sendCmd(rxget_command);
+        
+        // Response is +CIPRXGET: 2,<reqlength>,<cnflength> followed by
+        // exactly reqlength bytes of data
+        if(!waitFor("+CIPRXGET: 2,", "ERROR"))
+        {
+            break;
+        }
+        uint16_t len = readNumber();
+        uint16_t remaining = readNumber();
+        waitFor("\n", NULL, 100);
+        if(len > request)
+        {
+            len = request;
+        }
+        
+        uint16_t i = readExact(buff + total, len, 500);
+        total += i;
+        waitFor("OK", "ERROR", 500);
+        
+        // Stop once the modem has nothing more buffered
+        if(i < len || remaining == 0)
+        {
+            break;
+        }
     }
-    else
+    
+    return total;
+}
+
+uint16_t TR_SIM7000::pullTCP(char *buff, uint16_t maxlen)
+{
+    if(tcp_stack == eCA)
     {
-        return false;
+        return readCA(buff, maxlen);
     }
+    return readRXGET(buff, maxlen);
 }
 
-bool TR_SIM7000::send(char *data)
+uint16_t TR_SIM7000::readNumber(uint32_t timeout)
 {
-    char num[4];
-    char resp[20];
-    int len = strlen(data);
-    itoa(len, num, 10);
-    sendCmd("AT+CIPSEND=");
-    sendCmd(num);
-    if(checkSendCmd("\r\n",">"))
+    // Reads decimal digits and consumes the first non-digit terminator
+    uint16_t value = 0;
+    uint32_t timecnt = millis();
+    while((millis() - timecnt) < timeout)
     {
-        sendCmd(data);
-        while(1)
+        if(sim7000Serial->available())
         {
-            while(checkReadable())
+            char c = (char)sim7000Serial->read();
+            if(c < '0' || c > '9')
             {
-                readBuffer(resp,20);
-                if(NULL != strstr(resp,"OK"))
-                {
-                    return true;
-                }
-                if(NULL != strstr(resp,"ERROR"))
-                {
-                    return false;
-                }
+                break;
             }
+            value = (value * 10) + (c - '0');
         }
     }
-    else
+    return value;
+}
+
+bool TR_SIM7000::waitFor(const char* resp,
+                         const char* err,
+                         uint32_t timeout)
+{
+    // Rolling window of the most recent characters received
+    char window[32];
+    uint8_t len = 0;
+    
+    uint32_t start = millis();
+    while((millis() - start) < timeout)
     {
-    return false;
+        char c;
+        if(!readChar(c))
+        {
+            continue;
+        }
+        pushWindow(window, len, sizeof(window), c);
+        
+        if(windowEndsWith(window, len, resp))
+        {
+            return true;
+        }
+        if(err != NULL && windowEndsWith(window, len, err))
+        {
+            return false;
+        }
     }
+    return false;
 }
 
-bool TR_SIM7000::send(char *buf, size_t len)
+bool TR_SIM7000::readChar(char &c)
 {
-    char num[4];
-    itoa(len, num, 10);
-    sendCmd("AT+CIPSEND=");
-    sendCmd(num);
-    if(checkSendCmd("\r\n",">"))
+    while(sim7000Serial->available())
     {
-        if(checkSendCmd(buf,"OK"))
+        c = (char)sim7000Serial->read();
+        if(ipd_remaining == 0)
         {
+            scanURC(c);
             return true;
         }
+        
+        // Socket data is kept for readAvailable()
+        ipd_remaining--;
+        if(stash_count < stash_size)
+        {
+            rx_stash[(stash_head + stash_count) % stash_size] = c;
+            stash_count++;
+        }
         else
         {
-            return false;
+            stash_overflows++;
         }
     }
-    else
+    return false;
+}
+
+uint16_t TR_SIM7000::readExact(char *buffer,
+                               uint16_t length,
+                               uint32_t timeout)
+{
+    uint16_t i = 0;
+    uint32_t timecnt = millis();
+    while(i < length)
     {
-        return false;
+        if(sim7000Serial->available())
+        {
+            buffer[i++] = (char)sim7000Serial->read();
+            timecnt = millis();
+        }
+        else if((millis() - timecnt) > timeout)
+        {
+            break;
+        }
     }
+    return i;
 }
 
-bool TR_SIM7000::closeNetwork(void)
+bool TR_SIM7000::querySetting(const char* cmd, const char* enabled)
 {
-    if(checkSendCmd("AT+CIPSHUT\r\n","OK",2000))
+    sendCmd(cmd);
+    
+    // A disabled setting ends at OK without the enabled response
+    if(!waitFor(enabled, "OK", 1000))
     {
-        return true;
+        return false;
     }
-    else
+    waitFor("OK", "ERROR", 500);
+    return true;
+}
+
+bool TR_SIM7000::readLine(char *buffer,
+                          uint16_t max_length,
+                          uint32_t timeout)
+{
+    uint16_t i = 0;
+    uint32_t start = millis();
+    while((millis() - start) < timeout)
     {
-        return false;
+        char c;
+        if(!readChar(c))
+        {
+            continue;
+        }
+        if(c == '\n')
+        {
+            buffer[i] = '\0';
+            return true;
+        }
+        if(c != '\r' && i < max_length - 1)
+        {
+            buffer[i++] = c;
+        }
     }
+    buffer[i] = '\0';
+    return false;
 }
 
 bool TR_SIM7000::checkSendCmd(const char* cmd, 
@@ -814,10 +3600,12 @@ void TR_SIM7000::sendCmd(const char* cmd)
   sim7000Serial->write(cmd);
 }
 
+#ifndef TR_SIM7000_NO_ALLOC
 void TR_SIM7000::sendCmd(String cmd)
 {
   sim7000Serial->println(cmd);
 }
+#endif
 
 int TR_SIM7000::checkReadable(void)
 {
@@ -842,10 +3630,14 @@ uint16_t  TR_SIM7000::readBuffer(char *buffer,
     uint64_t timecnt = millis();
     while(1)
     {
-        if(sim7000Serial->available())
+        if(readChar(buffer[i]))
         {
-            buffer[i++] =(char)sim7000Serial->read();
+            i++;
             timecnt = millis();
+            if(i == 1)
+            {
+                rx_first = timecnt;
+            }
         }
         if(i == max_length)
             return i;
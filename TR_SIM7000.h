@@ -36,6 +36,100 @@
 #define ON  0
 #define OFF 1
 
+// Largest MQTT topic and payload held in the queue
+#ifndef TR_MQTT_TOPIC_MAX
+#define TR_MQTT_TOPIC_MAX 64
+#endif
+#ifndef TR_MQTT_PAYLOAD_MAX
+#define TR_MQTT_PAYLOAD_MAX 256
+#endif
+
+// Largest single send accepted by AT+CIPSEND and AT+CASEND
+#define TR_SEND_MAX 1460
+
+// Time (milliseconds) unacknowledged quick send data may go without
+// progress before the send is reported as failed
+#ifndef TR_QSEND_STALL
+#define TR_QSEND_STALL 20000
+#endif
+
+// Time (milliseconds) allowed for a TCP connection to open
+#ifndef TR_CONNECT_TIMEOUT
+#define TR_CONNECT_TIMEOUT 15000
+#endif
+
+// Time (milliseconds) between receive requests made by readAvailable() in
+// pull modes when the SIM7000 has not reported new data
+#ifndef TR_PULL_INTERVAL
+#define TR_PULL_INTERVAL 1000
+#endif
+
+// Time (milliseconds) attachService() waits for network registration
+#ifndef TR_REGISTRATION_TIMEOUT
+#define TR_REGISTRATION_TIMEOUT 180000
+#endif
+
+// Time (milliseconds) allowed to register on the stored cell before
+// scanning every band
+#ifndef TR_CELL_LOCK_TIMEOUT
+#define TR_CELL_LOCK_TIMEOUT 20000
+#endif
+
+// Bands restored when the stored cell cannot be used
+#ifndef TR_CATM_BANDS
+#define TR_CATM_BANDS "1,2,3,4,5,8,12,13,14,18,19,20,25,26,27,28,66,85"
+#endif
+#ifndef TR_NBIOT_BANDS
+#define TR_NBIOT_BANDS "1,2,3,4,5,8,12,13,17,18,19,20,25,26,28,66,71,85"
+#endif
+
+// Host names whose addresses are cached, and how long an address is used
+// before it is refreshed. AT+CDNSGIP does not report the record's TTL.
+#ifndef TR_DNS_CACHE
+#define TR_DNS_CACHE 4
+#endif
+#ifndef TR_DNS_TTL
+#define TR_DNS_TTL 3600000
+#endif
+
+// Time (milliseconds) a background lookup may take before it is given up
+#ifndef TR_DNS_TIMEOUT
+#define TR_DNS_TIMEOUT 10000
+#endif
+#define TR_DNS_HOST_MAX 64
+
+// Casters held by addCaster()
+#ifndef TR_CASTER_MAX
+#define TR_CASTER_MAX 4
+#endif
+
+// Time (milliseconds) a failed caster is skipped
+#ifndef TR_CASTER_RETRY
+#define TR_CASTER_RETRY 60000
+#endif
+
+// Time (milliseconds) without data before a caster counts as stalled
+#ifndef TR_CASTER_STALL
+#define TR_CASTER_STALL 10000
+#endif
+
+// Largest NTRIP request built on the stack for the caster
+#ifndef TR_NTRIP_REQUEST_MAX
+#define TR_NTRIP_REQUEST_MAX 256
+#endif
+
+// Define TR_SIM7000_NO_ALLOC to remove the String overloads so the driver
+// makes no dynamic allocation after init(), any heap or String use in the
+// library then fails to compile (TR_NoAlloc.h). Define TR_SIM7000_COUNT_ALLOC
+// to count heap allocations through operator new, and also
+// TR_SIM7000_WRAP_MALLOC when linking with -Wl,--wrap=malloc,--wrap=calloc,
+// --wrap=realloc to count C allocations.
+
+class TR_Sourcetable;
+class TR_CMUX;
+class TR_NMEAParser;
+class TR_LatencyMonitor;
+
 class TR_SIM7000
 {
     public:
@@ -63,6 +157,124 @@ class TR_SIM7000
           eNB,
       }eNet;
       
+    /**
+      * @enum eStack
+      * @brief Select the SIM7000 TCP/IP command set used for connections
+      */
+      typedef enum
+      {
+          eCIP,
+          eCA,
+      }eStack;
+      
+    /**
+      * @enum eCmd
+      * @brief State of a command started with startCmd()
+      */
+      typedef enum
+      {
+          eCmdIdle,
+          eCmdPending,
+          eCmdOK,
+          eCmdFail,
+      }eCmd;
+      
+    /**
+      * @enum eResume
+      * @brief How much of an existing SIM7000 session resume() recovered
+      */
+      typedef enum
+      {
+          eResumeNone,
+          eResumeModem,
+          eResumeRegistered,
+          eResumeAttached,
+          eResumeConnected,
+      }eResume;
+      
+    /**
+      * @enum eReg
+      * @brief Network registration status reported by +CEREG
+      */
+      typedef enum
+      {
+          eRegNone,
+          eRegHome,
+          eRegSearching,
+          eRegDenied,
+          eRegUnknown,
+          eRegRoaming,
+      }eReg;
+      
+    /**
+      * @struct cellInfo
+      * @brief Cell of the last successful registration
+      */
+      typedef struct
+      {
+          uint8_t act;      // Access technology, 0 GSM, 7 CAT-M, 9 NB-IoT
+          uint8_t band;     // LTE band, 0 if unknown
+          char oper[8];     // Numeric operator (MCC and MNC)
+      }cellInfo;
+      
+    /**
+      * @struct casterSource
+      * @brief Caster endpoint added with addCaster() and its statistics
+      */
+      typedef struct
+      {
+          const char* host;
+          int port;
+          const char* mntpnt;
+          const char* user;
+          const char* password;
+          uint32_t connect_time;      // Smoothed connection setup (ms)
+          uint32_t first_byte;        // Smoothed ICY 200 OK to data (ms)
+          uint32_t worst_connect;     // Slowest connection setup (ms)
+          uint32_t worst_first_byte;  // Slowest ICY 200 OK to data (ms)
+          uint16_t attempts;
+          uint16_t failures;
+          uint16_t stalls;
+          uint32_t failed_at;         // millis() of the last failure
+          bool healthy;
+      }casterSource;
+      
+    /**
+      * @enum eLink
+      * @brief State of the caster connection as seen by checkLink()
+      */
+      typedef enum
+      {
+          eLinkUp,
+          eLinkClosed,
+          eLinkDeact,
+          eLinkIdle,
+      }eLink;
+      
+    /**
+      * @struct sendSegment
+      * @brief One piece of the data passed to sendv()
+      */
+      typedef struct
+      {
+          const void *data;
+          size_t len;
+      }sendSegment;
+      
+    /**
+      * @struct mqttMessage
+      * @brief Outbound MQTT message, an array of these supplied with
+      *        setMQTTQueue() holds messages waiting to be published
+      */
+      typedef struct
+      {
+          char topic[TR_MQTT_TOPIC_MAX];
+          char payload[TR_MQTT_PAYLOAD_MAX];
+          uint16_t len;
+          uint8_t qos;
+          bool retain;
+      }mqttMessage;
+      
    /**
      * @fn init
      * @brief Initialize the library
@@ -76,6 +288,9 @@ class TR_SIM7000
      * @param psw_in NTRIP caster password
      * @param info_in NTRIP caster info
      * @param input_port SIM7000 serial port
+     * @param stack_in TCP/IP command set to use for connections
+     * @n    eCIP: Legacy single connection commands (AT+CIPSTART/CIPSEND)
+     * @n    eCA:  Application layer commands (AT+CAOPEN/CASEND/CARECV)
      * @return None
      */
     void init(int pwr_pin, 
@@ -87,7 +302,8 @@ class TR_SIM7000
               char* user_in,
               char* psw_in,
               char* info_in,
-              Stream &input_port);
+              Stream &input_port,
+              eStack stack_in = eCIP);
                
    /**
      * @fn connect
@@ -114,12 +330,180 @@ class TR_SIM7000
     */
    int checkSignalQuality(void);
   
+   /**
+    * @fn startRegistration
+    * @brief Enable registration URCs (AT+CEREG=2) so registration is
+    *        followed as it happens rather than polled
+    * @details Call as early as possible after setNetMode() so the radio
+    *          searches while the rest of setup runs. attachService() calls
+    *          it if it has not been called.
+    * @return bool type, indicating the status of setting
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool startRegistration(void);
+   
+   /**
+    * @fn getRegistration
+    * @brief Registration status from the most recent +CEREG seen, updated
+    *        whenever the driver reads from the SIM7000
+    * @return Registration status
+    */
+   eReg getRegistration(void);
+   
+   /**
+    * @fn setRegistrationCallback
+    * @brief Set a function called whenever the registration status changes
+    * @param callback Function receiving the new status
+    */
+   void setRegistrationCallback(void (*callback)(eReg state));
+  
+   /**
+    * @fn addCaster
+    * @brief Add a caster endpoint and mount point to choose from, the
+    *        caster passed to init() is not in the list unless added
+    * @param host_in Caster host name or address
+    * @param port_in Caster port
+    * @param mntpnt_in Mount point
+    * @param user_in Caster user id
+    * @param password_in Caster password
+    * @return bool type, indicating the caster was added
+    * @retval true Success 
+    * @retval false Failed, TR_CASTER_MAX casters already added
+    */
+   bool addCaster(const char* host_in,
+                  int port_in,
+                  const char* mntpnt_in,
+                  const char* user_in = "",
+                  const char* password_in = "");
+   
+   /**
+    * @fn probeCasters
+    * @brief Connect to each caster in turn to measure connection setup and
+    *        first byte latency, then disconnect
+    * @note The SIM7000 has one socket, a connected caster is closed first
+    * @return Index of the fastest healthy caster, -1 if none responded
+    */
+   int8_t probeCasters(void);
+   
+   /**
+    * @fn connectCaster
+    * @brief Connect to the fastest healthy caster, trying the others in
+    *        order of latency if it fails
+    * @details Casters without measurements are tried after measured ones
+    *          and failed casters are skipped for TR_CASTER_RETRY
+    *          milliseconds. Sets an inactivity timeout of TR_CASTER_STALL
+    *          if none was set.
+    * @return bool type, indicating a caster was connected
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool connectCaster(void);
+   
+   /**
+    * @fn maintainCaster
+    * @brief Check the active caster and switch to the next best one if it
+    *        closed or stalled, call regularly from the main loop
+    * @return bool type, indicating a caster is connected
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool maintainCaster(void);
+   
+   /**
+    * @fn getActiveCaster
+    * @brief Index of the connected caster
+    * @return Index, -1 if none is connected
+    */
+   int8_t getActiveCaster(void);
+   
+   /**
+    * @fn getCasterCount
+    * @brief Number of casters added
+    * @return Caster count
+    */
+   uint8_t getCasterCount(void);
+   
+   /**
+    * @fn getCaster
+    * @brief Caster endpoint and its statistics
+    * @param index Index from 0 to getCasterCount() - 1
+    * @return Caster
+    */
+   const casterSource& getCaster(uint8_t index);
+   
+   /**
+    * @fn getCasterSwitches
+    * @brief Number of automatic switches between casters
+    * @return Switch count
+    */
+   uint32_t getCasterSwitches(void);
+   
+   /**
+    * @fn printCasterStats
+    * @brief Log one line of statistics per caster
+    * @param out Destination, for example Serial
+    */
+   void printCasterStats(Print &out);
+   
+   /**
+    * @fn resolveHost
+    * @brief Look up a host name's address (AT+CDNSGIP), using the cache
+    *        while the address is fresh
+    * @details An address older than the TTL is still returned while a
+    *          refresh runs in the background. Needs an active PDP context.
+    *          Caster connections on both stacks, and those made by
+    *          TR_SIM7000Pool, open by the cached address when there is one.
+    * @param name Host name or dotted IP address
+    * @param ip Buffer of at least 16 characters for the address
+    * @param timeout Time (milliseconds) to wait for an uncached lookup
+    * @return bool type, indicating an address was found
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool resolveHost(const char* name, char *ip, uint32_t timeout = 10000);
+   
+   /**
+    * @fn refreshDNS
+    * @brief Start a lookup without waiting, the result is cached when its
+    *        URC is read
+    * @param name Host name
+    * @return bool type, indicating the lookup was started
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool refreshDNS(const char* name);
+   
+   /**
+    * @fn setDNSTTL
+    * @brief Set how long a resolved address is used before it is refreshed
+    * @param ttl Time (milliseconds)
+    */
+   void setDNSTTL(uint32_t ttl);
+   
+   /**
+    * @fn setCellStorage
+    * @brief Set functions that persist the cell of the last successful
+    *        registration, for example in EEPROM or flash
+    * @details With storage set, connect() first locks the band and
+    *          operator of the stored cell and only scans every band if
+    *          that fails to register on it within TR_CELL_LOCK_TIMEOUT.
+    *          The band lock is lifted again once registered.
+    * @param load Function filling in the stored cell, returning false if
+    *        none is stored
+    * @param save Function storing a cell, called when it changes
+    */
+   void setCellStorage(bool (*load)(cellInfo &cell),
+                       void (*save)(const cellInfo &cell));
+  
    /**
     * @fn attacthService
-    * @brief Open the connection
+    * @brief Open the connection, starting PDP setup as soon as the network
+    *        reports registration (home or roaming)
     * @return bool type, indicating the status of opening the connection
     * @retval true Success 
-    * @retval false Failed
+    * @retval false Failed, registration denied or not registered within
+    *         TR_REGISTRATION_TIMEOUT
     */
    bool attachService(void);
 
@@ -132,6 +516,36 @@ class TR_SIM7000
     */
    bool turnON(void);
   
+   /**
+    * @fn resume
+    * @brief Probe for a SIM7000 that is already powered, for example after a
+    *        host reset, and recover its baud rate, registration, IP address
+    *        and TCP connection state without power cycling it
+    * @param set_host_baud Optional function changing the host serial rate,
+    *        used to search for the SIM7000 baud rate if it does not respond
+    *        at the current rate
+    * @return eResume type, indicating how far the session was recovered
+    * @n    eResumeNone:       Not responding, turnON() is needed
+    * @n    eResumeModem:      Responding but not registered
+    * @n    eResumeRegistered: Registered without an active PDP context
+    * @n    eResumeAttached:   PDP context active, no TCP connection. A
+    *                         connection left in transparent mode is
+    *                         closed, startMux() is needed to use the
+    *                         context.
+    * @n    eResumeConnected:  TCP connection still open, manual receive
+    *                         and quick send are restored from the SIM7000
+    *                         and establishTCPConnectionClient() reuses
+    *                         the connection
+    */
+   eResume resume(void (*set_host_baud)(long) = NULL);
+   
+   /**
+    * @fn getIPAddress
+    * @brief IP address recovered by resume()
+    * @return IP address, empty if unknown
+    */
+   const char* getIPAddress(void);
+  
    /**
     * @fn setBaudRate
     * @brief Set baud rate to avoid garbled
@@ -190,6 +604,180 @@ class TR_SIM7000
                     uint16_t maxlen);
                     
     boolean checkTCP(void);
+    
+   /**
+    * @fn startMux
+    * @brief Start the GSM 07.10 multiplexer (AT+CMUX=0) with a transparent
+    *        data channel for the caster stream and a channel for AT commands
+    * @details Must be called before attachService() since transparent mode
+    *          (AT+CIPMODE=1) can only be selected before the PDP context is
+    *          up. Afterwards establishTCPConnectionClient(), readTCP() and
+    *          send() use the data channel while every other call runs on the
+    *          command channel without interrupting the stream.
+    * @param mux_in Multiplexer to run on the SIM7000 serial port
+    * @return bool type, indicating the status of starting the multiplexer
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool startMux(TR_CMUX &mux_in);
+   
+   /**
+    * @fn stopMux
+    * @brief Close the multiplexer and return to the SIM7000 serial port
+    */
+   void stopMux(void);
+   
+   /**
+    * @fn findNearestMountpoint
+    * @brief Fetch the caster sourcetable (GET /), parse it as it streams in
+    *        and select the nearest suitable mount point for the connection
+    * @details The table's result is reused without a new request while the
+    *          rover stays near the position it was fetched for. Filters set
+    *          on the table decide which mount points are suitable.
+    * @param table Sourcetable parser holding the cached result
+    * @param lat Rover latitude (degrees)
+    * @param lon Rover longitude (degrees)
+    * @param timeout Maximum amount of time (milliseconds) to read the table
+    * @return bool type, indicating a mount point was selected
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool findNearestMountpoint(TR_Sourcetable &table,
+                              double lat,
+                              double lon,
+                              uint32_t timeout = 60000);
+   
+   /**
+    * @fn setManualReceive
+    * @brief Enable or disable manual receive mode (AT+CIPRXGET=1)
+    * @details In manual receive mode socket data is buffered by the SIM7000
+    *          and readTCP() pulls exact length chunks with AT+CIPRXGET=2
+    *          instead of reading the serial line until it is idle. Must be
+    *          set before the TCP connection is established. Only applies to
+    *          the eCIP stack, the eCA stack always reads with AT+CARECV.
+    * @param enable true to enable manual receive mode
+    * @return bool type, indicating the status of setting
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool setManualReceive(bool enable);
+   
+   /**
+    * @fn availableTCP
+    * @brief Query the number of received bytes buffered by the SIM7000
+    * @note Only available in manual receive mode (AT+CIPRXGET=4)
+    * @return Number of bytes waiting to be read
+    */
+   uint16_t availableTCP(void);
+   
+   /**
+    * @fn setQuickSend
+    * @brief Enable or disable quick send mode (AT+CIPQSEND=1)
+    * @details In quick send mode a send returns once the SIM7000 has
+    *          accepted the data (DATA ACCEPT) rather than once the server
+    *          has acknowledged it (SEND OK), so several sends are in flight
+    *          at once. A send is refused while the bytes not yet
+    *          acknowledged (AT+CIPACK) would exceed the window. Only
+    *          applies to the eCIP stack.
+    * @param enable true to enable quick send mode
+    * @param window Bytes allowed in flight, 0 to use the SIM7000's send
+    *        buffer size (AT+CIPSEND?)
+    * @return bool type, indicating the status of setting
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool setQuickSend(bool enable, uint32_t window = 0);
+   
+   /**
+    * @fn updateInFlight
+    * @brief Refresh the count of bytes sent but not acknowledged by the
+    *        server (AT+CIPACK) and check for a stalled connection
+    * @details Call periodically while sending in quick send mode. When
+    *          unacknowledged bytes make no progress for TR_QSEND_STALL
+    *          milliseconds the send failure callback is called.
+    * @note Reads only up to the end of the reply. Correction data pushed
+    *       by the server meanwhile is kept when a receive buffer is set
+    *       (setReceiveBuffer()) or manual receive mode is enabled.
+    * @return bool type, indicating the query succeeded
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool updateInFlight(void);
+   
+   /**
+    * @fn getInFlight
+    * @brief Bytes accepted by the SIM7000 but not yet acknowledged by the
+    *        server, as of the last AT+CIPACK plus any sent since
+    * @return Byte count
+    */
+   uint32_t getInFlight(void);
+   
+   /**
+    * @fn setSendFailureCallback
+    * @brief Set a function called when data sent in quick send mode is
+    *        not delivered
+    * @param callback Function receiving the number of bytes not
+    *        acknowledged by the server
+    */
+   void setSendFailureCallback(void (*callback)(uint32_t unacked));
+   
+   /**
+    * @fn getSendFailures
+    * @brief Number of quick send failures detected
+    * @return Failure count
+    */
+   uint32_t getSendFailures(void);
+   
+   /**
+    * @fn setKeepAlive
+    * @brief Configure TCP keepalive probes (AT+CIPTKA) so a connection
+    *        whose NAT state was dropped is closed by the SIM7000
+    * @note Only applies to the eCIP stack, set before connecting
+    * @param enable true to send keepalive probes
+    * @param idle Idle time (seconds) before the first probe
+    * @param interval Time (seconds) between probes
+    * @param count Unanswered probes before the connection is closed
+    * @return bool type, indicating the status of setting
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool setKeepAlive(bool enable,
+                     uint16_t idle = 30,
+                     uint16_t interval = 10,
+                     uint8_t count = 3);
+   
+   /**
+    * @fn setInactivityTimeout
+    * @brief Declare the link dead when no caster data arrives for a time
+    * @param timeout Time (milliseconds) without data, 0 to disable
+    */
+   void setInactivityTimeout(uint32_t timeout);
+   
+   /**
+    * @fn setLinkCallback
+    * @brief Set a function called when the link is declared dead
+    * @param callback Function receiving the reason
+    */
+   void setLinkCallback(void (*callback)(eLink reason));
+   
+   /**
+    * @fn checkLink
+    * @brief Check the connection without an AT command round trip, using
+    *        the CLOSED and PDP deactivation URCs seen while reading and the
+    *        inactivity timeout
+    * @return eLinkUp, or the reason the link is dead
+    */
+   eLink checkLink(void);
+   
+   /**
+    * @fn reconnect
+    * @brief Reopen the caster connection after checkLink() reported it
+    *        dead, reactivating the PDP context if it was deactivated
+    * @return bool type, indicating the connection was reopened
+    * @retval true Success 
+    * @retval false Failed
+    */
+   bool reconnect(void);
 
   /**
    * @fn send
@@ -211,61 +799,1024 @@ class TR_SIM7000
    * @retval false Failed
    */
   bool send(char *data);
-
   
-private:
-
-    // Baud rate for communicating with SIM7000
-	long baud_rate = 19200;
-    
-    // Serial port (passed in on init) for communicating with SIM7000
-	Stream *sim7000Serial;
-    
-    // Power key (passed in on init) for enabling the SIM7000
-    uint8_t PWRKEY = 23;
-    
-    // Reset key (passed in on init) for resetting SIM7000
-    uint8_t RESET = 6;
-    
-    // Provider network APN (passed in on init)
-    char* APN;
-    
-    // NTRIP caster host (IP address)
-    char* host;
-    
-    // NTRIP caster port to use
-    int tcp_port;
-    
-    // NTRIP caster mount point to connect to
-    char* mntpnt;
-    
-    // NTRIP caster user id
-    char* user;
-    
-    // NTRIP caster password
-    char* psw;
-    
-    // NTRIP caster info
-    char* info;
-    
-    /**
-     * @fn checkSendCmd
-     * @brief Send a command to SIM7000 and check response
-     * @param cmd Command to send
-     * @param resp Desired response from SIM7000
-     * @param timeout Amount of time (milliseconds) to wait for response
-     * @return bool type, indicates if desired response was received
-     * @retval true Desired response received 
-     * @retval false Desired response not received
-     */
-    bool checkSendCmd(const char* cmd, 
-                      const char* resp, 
-                      uint32_t timeout = 1000);
-                      
-    /**
-     * @fn sendCmd
-     * @brief Send a command to SIM7000 without checking for response
-     * @param cmd Command to send
+  /**
+   * @fn sendv
+   * @brief Send several buffers as one TCP send, for example a header and
+   *        a payload, without copying them together. Data is written
+   *        verbatim so it may contain NUL bytes.
+   * @param segments Buffers to send in order
+   * @param count Number of buffers
+   * @return bool type, indicating the SIM7000 accepted the data
+   * @retval true Success 
+   * @retval false Failed or more than TR_SEND_MAX bytes in total
+   */
+  bool sendv(const sendSegment *segments, uint8_t count);
+  
+  /**
+   * @fn setPSM
+   * @brief Configure power saving mode (AT+CPSMS)
+   * @param enable true to request PSM from the network
+   * @param tau Requested periodic TAU (T3412) as an 8 bit string
+   * @param active_time Requested active time (T3324) as an 8 bit string
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool setPSM(bool enable,
+              const char* tau = "00100001",
+              const char* active_time = "00000101");
+  
+  /**
+   * @fn setEDRX
+   * @brief Configure extended discontinuous reception (AT+CEDRXS)
+   * @param enable true to request eDRX from the network
+   * @param net The net mode eDRX applies to
+   * @param cycle Requested eDRX cycle as a 4 bit string
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool setEDRX(bool enable, eNet net, const char* cycle = "0101");
+  
+  /**
+   * @fn setDTRPin
+   * @brief Set the GPIO wired to the SIM7000 DTR and enable UART sleep
+   *        (AT+CSCLK=1) so wake() does not need the power key
+   * @param dtr_pin Pin number for GPIO controlling SIM7000 DTR
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool setDTRPin(int dtr_pin);
+  
+  /**
+   * @fn wake
+   * @brief Wake SIM7000 from sleep or PSM without a reset
+   * @return bool type, indicating the SIM7000 is responding
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool wake(void);
+  
+  /**
+   * @fn sleep
+   * @brief Allow the SIM7000 to return to sleep or PSM
+   */
+  void sleep(void);
+  
+  /**
+   * @fn wakeSendSleep
+   * @brief Wake SIM7000, send data reusing the existing registration and
+   *        PDP context, then allow it to sleep again
+   * @param buf The buffer for data to be send
+   * @param len The length of data to be send
+   * @param latency Time (milliseconds) from start of wake to data sent
+   * @return bool type, indicating status of sending
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool wakeSendSleep(char *buf, size_t len, uint32_t &latency);
+  
+  /**
+   * @fn getWakeLatency
+   * @brief Wake to send latency of the last wakeSendSleep() call
+   * @return Latency in milliseconds
+   */
+  uint32_t getWakeLatency(void);
+  
+  /**
+   * @fn mqttConfig
+   * @brief Configure the SIM7000 MQTT client (AT+SMCONF)
+   * @param broker MQTT broker host
+   * @param port MQTT broker port
+   * @param client_id MQTT client id
+   * @param username MQTT user name or NULL
+   * @param password MQTT password or NULL
+   * @param keepalive Keep alive time (seconds)
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool mqttConfig(const char* broker,
+                  int port,
+                  const char* client_id,
+                  const char* username = NULL,
+                  const char* password = NULL,
+                  uint16_t keepalive = 60);
+  
+  /**
+   * @fn mqttConnect
+   * @brief Connect to the MQTT broker (AT+SMCONN) and publish any queued
+   *        messages
+   * @return bool type, indicating the status of connecting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool mqttConnect(void);
+  
+  /**
+   * @fn mqttDisconnect
+   * @brief Disconnect from the MQTT broker (AT+SMDISC)
+   * @return bool type, indicating the status of disconnecting
+   */
+  bool mqttDisconnect(void);
+  
+  /**
+   * @fn mqttConnected
+   * @brief Query the MQTT connection state (AT+SMSTATE?)
+   * @return bool type, indicating the client is connected
+   */
+  bool mqttConnected(void);
+  
+  /**
+   * @fn setMQTTQueue
+   * @brief Supply storage for messages published while disconnected or
+   *        batching, without it those publishes fail. Any queued messages
+   *        are dropped.
+   * @param queue Array of messages, NULL to stop queueing
+   * @param size Number of messages in the array
+   */
+  void setMQTTQueue(mqttMessage *queue, uint8_t size);
+  
+  /**
+   * @fn setMQTTBatch
+   * @brief Queue every publish until mqttFlush() so a batch is sent
+   *        back to back after a single connection check
+   * @param enable true to enable batching
+   * @param separator If not 0, consecutive queued messages with the same
+   *        topic, QoS and retain flag are joined with this character and
+   *        sent as one publish
+   */
+  void setMQTTBatch(bool enable, char separator = '\0');
+  
+  /**
+   * @fn mqttPublish
+   * @brief Publish a message (AT+SMPUB), queueing it while disconnected or
+   *        batching
+   * @param topic Topic to publish to
+   * @param payload Message payload, copied when queued
+   * @param len Length of the payload
+   * @param qos Quality of service, 0 or 1
+   * @param retain Retain flag
+   * @return bool type, indicating the message was published or queued
+   * @retval true Success 
+   * @retval false Too large, or it had to be queued and the queue is full
+   *         or was never set
+   */
+  bool mqttPublish(const char* topic,
+                   const char* payload,
+                   uint16_t len,
+                   uint8_t qos = 0,
+                   bool retain = false);
+  
+  /**
+   * @fn mqttFlush
+   * @brief Publish queued messages while connected
+   * @return Number of queued messages published
+   */
+  uint8_t mqttFlush(void);
+  
+  /**
+   * @fn mqttQueued
+   * @brief Number of messages waiting to be published
+   * @return Message count
+   */
+  uint8_t mqttQueued(void);
+  
+  /**
+   * @fn mqttSubscribe
+   * @brief Subscribe to a topic (AT+SMSUB)
+   * @param topic Topic to subscribe to
+   * @param qos Quality of service, 0 or 1
+   * @return bool type, indicating the status of subscribing
+   */
+  bool mqttSubscribe(const char* topic, uint8_t qos = 0);
+  
+  /**
+   * @fn mqttUnsubscribe
+   * @brief Unsubscribe from a topic (AT+SMUNSUB)
+   * @param topic Topic to unsubscribe from
+   * @return bool type, indicating the status of unsubscribing
+   */
+  bool mqttUnsubscribe(const char* topic);
+  
+  /**
+   * @fn mqttRecv
+   * @brief Wait for a message on a subscribed topic
+   * @param topic Buffer populated with the message topic
+   * @param topic_len Size of the topic buffer
+   * @param payload Buffer populated with the message payload
+   * @param payload_len Size of the payload buffer, set to the payload length
+   * @param timeout Amount of time (milliseconds) to wait for a message
+   * @return bool type, indicating a message was received
+   */
+  bool mqttRecv(char *topic,
+                uint16_t topic_len,
+                char *payload,
+                uint16_t &payload_len,
+                uint32_t timeout = 1000);
+  
+  /**
+   * @fn setReceiveBuffer
+   * @brief Frame socket data with +IPD headers (AT+CIPHEAD=1) so data that
+   *        arrives while a command runs is kept for readAvailable() and
+   *        readTCP() instead of being read as part of the response
+   * @details Without it, socket data in push mode cannot be told apart from
+   *          command responses. Only applies to the eCIP stack in push
+   *          mode, manual receive and the CA stack already keep data in
+   *          the SIM7000 until it is requested.
+   * @param buffer Buffer for the kept data, NULL to turn headers off
+   * @param size Size of the buffer
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool setReceiveBuffer(char *buffer, uint16_t size);
+  
+  /**
+   * @fn getReceiveOverflows
+   * @brief Number of socket data bytes dropped because the receive buffer
+   *        was full
+   * @return Byte count
+   */
+  uint32_t getReceiveOverflows(void);
+  
+  /**
+   * @fn startCmd
+   * @brief Send a command without waiting for the response, progress is
+   *        checked with pollCmd()
+   * @param cmd Command to send
+   * @param resp Desired response from SIM7000
+   * @param err Error response from SIM7000, may be NULL. ERROR always
+   *        fails the command.
+   * @param timeout Amount of time (milliseconds) to wait for response
+   * @return bool type, indicating the command was sent
+   * @retval true Success 
+   * @retval false Another command or a receive request is still pending
+   */
+  bool startCmd(const char* cmd,
+                const char* resp,
+                const char* err = "ERROR",
+                uint32_t timeout = 1000);
+  
+  /**
+   * @fn pollCmd
+   * @brief Check for the response to a command started with startCmd()
+   *        using only the characters already received
+   * @note Socket data is passed through to readAvailable() when a receive
+   *       buffer is set, every other character read is consumed
+   * @return eCmdIdle, eCmdPending, eCmdOK or eCmdFail (error or timeout)
+   */
+  eCmd pollCmd(void);
+  
+  /**
+   * @fn readAvailable
+   * @brief Read TCP data that has already arrived without waiting for the
+   *        line to go idle
+   * @details In manual receive mode and with the CA stack the data is
+   *          requested from the SIM7000 when it reports new data, or every
+   *          TR_PULL_INTERVAL milliseconds, and collected over later calls.
+   *          Returns nothing while a command started with startCmd() is
+   *          pending, except data kept in the receive buffer.
+   * @param buff Buffer to populate with TCP data
+   * @param maxlen Maximum length of data to populate
+   * @return Number of bytes read
+   */
+  uint16_t readAvailable(char *buff, uint16_t maxlen);
+  
+  /**
+   * @fn setGNSSPower
+   * @brief Turn the SIM7000G GNSS engine on or off (AT+CGNSPWR)
+   * @param on true to power the engine
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool setGNSSPower(bool on);
+  
+  /**
+   * @fn setGNSSPort
+   * @brief Select the port the GNSS engine writes NMEA to (AT+CGNSCFG)
+   * @param port 0 for none, otherwise the NMEA port number from the
+   *        SIM7000 AT command manual
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool setGNSSPort(uint8_t port);
+  
+  /**
+   * @fn setGNSSStream
+   * @brief Stream NMEA sentences on the AT port (AT+CGNSTST)
+   * @details Sentences share the port with URCs and, in push mode, with
+   *          socket data. Use a receive buffer (setReceiveBuffer()),
+   *          manual receive, the CA stack or the multiplexer so socket
+   *          data is not mixed with them.
+   * @param enable true to stream sentences
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool setGNSSStream(bool enable);
+  
+  /**
+   * @fn sendGNSSCommand
+   * @brief Pass a command sentence to the GNSS engine (AT+CGNSCMD)
+   * @param sentence Sentence without '$', '*' or checksum, for example
+   *        "PMTK220,200"
+   * @return bool type, indicating the status of sending
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool sendGNSSCommand(const char* sentence);
+  
+  /**
+   * @fn setGNSSRate
+   * @brief Set the position update period of the GNSS engine
+   * @param period Update period (milliseconds), 100 for 10 Hz
+   * @return bool type, indicating the status of setting
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool setGNSSRate(uint16_t period);
+  
+  /**
+   * @fn readGNSS
+   * @brief Pass NMEA already received on the AT port to a parser without
+   *        waiting
+   * @details URCs among the sentences are still handled. Reads nothing
+   *          while a command started with startCmd() or a receive
+   *          request started by readAvailable() is pending.
+   * @param parser Parser to feed
+   * @return Number of sentences that updated the parser's fix
+   */
+  uint8_t readGNSS(TR_NMEAParser &parser);
+
+  /**
+   * @fn setLatencyMonitor
+   * @brief Record the arrival and forward time of every chunk returned by
+   *        readTCP() and the age of the RTCM observations in it
+   * @param monitor Monitor to record to, NULL to stop recording
+   */
+  void setLatencyMonitor(TR_LatencyMonitor *monitor);
+  
+  /**
+   * @fn syncClock
+   * @brief Set a latency monitor's clock from the SIM7000 real time clock
+   *        (AT+CCLK), optionally setting that from an NTP server first
+   * @details The clock is sampled until its seconds change so the offset
+   *          is accurate to a command round trip rather than a second.
+   *          NTP needs an active data connection.
+   * @param monitor Monitor whose clock is set
+   * @param ntp_server NTP server to query, NULL to use the clock as is
+   * @return bool type, indicating the clock was set
+   * @retval true Success 
+   * @retval false Failed
+   */
+  bool syncClock(TR_LatencyMonitor &monitor, const char* ntp_server = NULL);
+  
+#ifdef TR_SIM7000_COUNT_ALLOC
+  /**
+   * @fn getAllocationCount
+   * @brief Number of heap allocations made by the program, compare before
+   *        and after a connect, send and receive cycle to check that the
+   *        driver does not allocate
+   * @return Allocation count
+   */
+  static uint32_t getAllocationCount(void);
+#endif
+  
+private:
+
+    friend class TR_SIM7000Pool;
+    friend class TR_SIM7000Task;
+
+    // Baud rate for communicating with SIM7000
+	long baud_rate = 19200;
+    
+    // Serial port (passed in on init) for communicating with SIM7000
+	Stream *sim7000Serial;
+    
+    // Power key (passed in on init) for enabling the SIM7000
+    uint8_t PWRKEY = 23;
+    
+    // Reset key (passed in on init) for resetting SIM7000
+    uint8_t RESET = 6;
+    
+    // IP address of the active PDP context
+    char ip_address[16] = "";
+    
+    // DTR pin for UART sleep, -1 when not connected
+    int DTR = -1;
+    
+    // Wake to send latency (milliseconds) of the last wakeSendSleep()
+    uint32_t last_wake_latency = 0;
+    
+    // Quick send mode and in-flight accounting
+    bool quick_send = false;
+    uint32_t qsend_window = TR_SEND_MAX;
+    uint32_t qsend_unacked = 0;
+    uint32_t qsend_pending = 0;
+    uint32_t qsend_acked = 0;
+    uint32_t qsend_progress = 0;
+    uint32_t qsend_failures = 0;
+    void (*send_failure_callback)(uint32_t unacked) = NULL;
+    
+    // Link state from URCs and the inactivity watchdog
+    eLink link_state = eLinkUp;
+    bool link_quiet = false;
+    uint32_t inactivity_timeout = 0;
+    uint32_t last_rx = 0;
+    void (*link_callback)(eLink reason) = NULL;
+    
+    // Registration status from +CEREG
+    eReg reg_state = eRegNone;
+    uint32_t reg_reports = 0;
+    bool reg_urcs = false;
+    void (*reg_callback)(eReg state) = NULL;
+    
+    // Cell of the last successful registration and its storage
+    cellInfo cell = {0, 0, ""};
+    bool (*cell_load)(cellInfo &cell) = NULL;
+    void (*cell_save)(const cellInfo &cell) = NULL;
+    
+    // Caster list and the caster currently connected
+    casterSource casters[TR_CASTER_MAX];
+    uint8_t caster_count = 0;
+    int8_t active_caster = -1;
+    uint32_t caster_switches = 0;
+    uint32_t connected_at = 0;
+    bool awaiting_first = false;
+    
+    // Resolved caster addresses
+    typedef struct
+    {
+        char host[TR_DNS_HOST_MAX];
+        char ip[16];
+        uint32_t resolved;
+        uint32_t requested;
+        bool valid;
+        bool pending;
+    }dnsEntry;
+    dnsEntry dns_cache[TR_DNS_CACHE] = {};
+    uint8_t dns_next = 0;
+    uint32_t dns_ttl = TR_DNS_TTL;
+    
+    // Start of the line being received, checked for URCs
+    char urc_line[112];
+    uint8_t urc_len = 0;
+    
+    // Correction latency monitor, NULL when not recording
+    TR_LatencyMonitor *latency = NULL;
+    
+    // millis() when readBuffer() received its first character
+    uint32_t rx_first = 0;
+    
+    // Provider network APN (passed in on init)
+    char* APN;
+    
+    // NTRIP caster host (IP address)
+    char* host;
+    
+    // NTRIP caster port to use
+    int tcp_port;
+    
+    // NTRIP caster mount point to connect to
+    char* mntpnt;
+    
+    // NTRIP caster user id
+    char* user;
+    
+    // NTRIP caster password
+    char* psw;
+    
+    // NTRIP caster info
+    char* info;
+    
+    // TCP/IP command set (passed in on init)
+    eStack tcp_stack = eCIP;
+    
+    // Connection id used with the CA command set
+    uint8_t ca_cid = 0;
+    
+    // Manual receive mode (AT+CIPRXGET=1) enabled
+    bool manual_rx = false;
+    
+    // Connection found open by resume(), not yet taken over
+    bool resumed_socket = false;
+    
+    // Multiplexer (passed in on startMux) and its channels
+    TR_CMUX *mux = NULL;
+    Stream *raw_port = NULL;
+    Stream *data_port = NULL;
+    
+    // MQTT state and queue of outbound messages (passed in on setMQTTQueue)
+    bool mqtt_connected = false;
+    bool mqtt_batch = false;
+    char mqtt_separator = '\0';
+    mqttMessage *mqtt_queue = NULL;
+    uint8_t mqtt_size = 0;
+    uint8_t mqtt_head = 0;
+    uint8_t mqtt_count = 0;
+    
+    // Socket data kept while a command runs, with +IPD headers enabled
+    char *rx_stash = NULL;
+    uint16_t stash_size = 0;
+    uint16_t stash_head = 0;
+    uint16_t stash_count = 0;
+    uint32_t stash_overflows = 0;
+    uint16_t ipd_remaining = 0;
+    
+    // Receive request started by readAvailable() in pull modes
+    typedef enum
+    {
+        ePullIdle,
+        ePullHeader,
+        ePullLength,
+        ePullRemaining,
+        ePullData,
+        ePullEnd,
+    }ePull;
+    ePull pull_state = ePullIdle;
+    uint16_t pull_request = 0;
+    uint16_t pull_len = 0;
+    uint16_t pull_remaining = 0;
+    uint32_t pull_progress = 0;
+    uint32_t pull_last = 0;
+    bool rx_ready = false;
+    
+    // Command started with startCmd() waiting for a response
+    bool cmd_pending = false;
+    const char* async_resp;
+    const char* async_err;
+    uint32_t async_timeout;
+    uint32_t async_start;
+    char async_window[32];
+    uint8_t async_len = 0;
+    
+    /**
+     * @fn probe
+     * @brief Check that the SIM7000 responds to AT commands, leaving a stale
+     *        multiplexer or transparent connection if needed
+     * @return bool type, indicating the SIM7000 responded
+     */
+    bool probe(void);
+    
+    /**
+     * @fn queryIPAddress
+     * @brief Read the IP address of the active PDP context
+     * @return bool type, indicating a PDP context is active
+     */
+    bool queryIPAddress(void);
+    
+    /**
+     * @fn fetchSourcetable
+     * @brief Request the caster's sourcetable and feed it to a table
+     * @param table Sourcetable begun for the rover position
+     * @param timeout Time (milliseconds) to wait for the whole table
+     * @return bool type, indicating the request was sent
+     */
+    bool fetchSourcetable(TR_Sourcetable &table, uint32_t timeout);
+    
+    /**
+     * @fn isRegistered
+     * @brief Check network registration with AT+CEREG?
+     * @return bool type, indicating registration on home or roaming network,
+     *         false when the SIM7000 does not report its status
+     */
+    bool isRegistered(void);
+    
+    /**
+     * @fn applyCachedCell
+     * @brief Register on the stored cell's band and operator
+     *        (AT+CBANDCFG, AT+COPS=4), then search every band again
+     * @return bool type, indicating registration on the stored cell
+     * @retval true Success 
+     * @retval false Failed, registered elsewhere or no stored cell
+     */
+    bool applyCachedCell(void);
+    
+    /**
+     * @fn recordCell
+     * @brief Read the serving cell and store it if it changed
+     * @return bool type, indicating the cell was read
+     */
+    bool recordCell(void);
+    
+    /**
+     * @fn readServingCell
+     * @brief Read the serving cell's access technology and band
+     *        (AT+CPSI?) and numeric operator (AT+COPS?)
+     * @param found Cell to fill in
+     * @return bool type, indicating the cell was read
+     */
+    bool readServingCell(cellInfo &found);
+    
+    /**
+     * @fn openConnection
+     * @brief Open a TCP connection to the caster using the active stack
+     * @return bool type, indicating the status of opening the connection
+     * @retval true Success 
+     * @retval false Failed
+     */
+    bool openConnection(void);
+    
+    /**
+     * @fn openCIPConnection
+     * @brief Open a TCP connection to the caster using AT+CIPSTART
+     * @param target Caster host name or address
+     * @return bool type, indicating the status of opening the connection
+     * @retval true Success 
+     * @retval false Failed or not connected within TR_CONNECT_TIMEOUT
+     */
+    bool openCIPConnection(const char* target);
+    
+    /**
+     * @fn selectCaster
+     * @brief Point the connection settings at a caster from the list
+     * @param index Caster index
+     */
+    void selectCaster(uint8_t index);
+    
+    /**
+     * @fn casterScore
+     * @brief Expected latency of a caster, lower is better
+     * @param index Caster index
+     * @return Latency (milliseconds), or a large value without measurements
+     */
+    uint32_t casterScore(uint8_t index);
+    
+    /**
+     * @fn casterFailed
+     * @brief Record a failed connection or stall
+     * @param index Caster index
+     */
+    void casterFailed(uint8_t index);
+    
+    /**
+     * @fn recordLatency
+     * @brief Add a sample to a smoothed latency and its worst case
+     */
+    void recordLatency(uint32_t &smoothed, uint32_t &worst, uint32_t sample);
+    
+    /**
+     * @fn waitFirstByte
+     * @brief Wait for caster data after the NTRIP response, reading and
+     *        dropping it
+     * @param timeout Time (milliseconds) to wait
+     * @return bool type, indicating data arrived
+     */
+    bool waitFirstByte(uint32_t timeout);
+    
+    /**
+     * @fn readCasterReply
+     * @brief Read the caster's status line, leaving the data after it
+     * @param timeout Time (milliseconds) to wait
+     * @return bool type, indicating the caster answered ICY 200 OK
+     */
+    bool readCasterReply(uint32_t timeout);
+    
+    /**
+     * @fn findDNS
+     * @brief Cache entry for a host name
+     * @param name Host name
+     * @param create true to reuse the oldest entry if there is none
+     * @return Entry, NULL if there is none and create is false
+     */
+    dnsEntry* findDNS(const char* name, bool create);
+    
+    /**
+     * @fn dnsPending
+     * @brief Check for a lookup still running, giving it up once it is
+     *        older than TR_DNS_TIMEOUT
+     * @param entry Cache entry
+     * @return bool type, indicating a lookup is running
+     */
+    bool dnsPending(dnsEntry *entry);
+    
+    /**
+     * @fn startLookup
+     * @brief Mark a host name's lookup as running, before AT+CDNSGIP is
+     *        sent since the result can follow OK immediately
+     * @param name Host name
+     * @return Cache entry
+     */
+    dnsEntry* startLookup(const char* name);
+    
+    /**
+     * @fn lookupDue
+     * @brief Check if a host name has no fresh cached address and no
+     *        lookup running
+     * @param name Host name or dotted IP address
+     * @return bool type, indicating a lookup should be started
+     */
+    bool lookupDue(const char* name);
+    
+    /**
+     * @fn cachedAddress
+     * @brief Cached address of a host name without a lookup
+     * @param name Host name
+     * @return Address, or the host name if none is cached
+     */
+    const char* cachedAddress(const char* name);
+    
+    /**
+     * @fn isAddress
+     * @brief Check if a host name is a dotted IP address
+     */
+    bool isAddress(const char* name);
+    
+    /**
+     * @fn parseDNS
+     * @brief Cache the address from a +CDNSGIP line
+     * @param line Line starting after "+CDNSGIP: "
+     */
+    void parseDNS(const char *line);
+    
+    /**
+     * @fn ntripRequest
+     * @brief Build the NTRIP client request for the configured mount point
+     * @param buff Buffer for the request
+     * @param maxlen Size of the buffer
+     * @return Length of the request, 0 if it does not fit
+     */
+    size_t ntripRequest(char *buff, size_t maxlen);
+    
+    /**
+     * @fn base64Encode
+     * @brief Base64 encode data for HTTP basic authentication
+     * @param in Data to encode
+     * @param in_len Length of data to encode
+     * @param out Buffer for the null terminated encoding
+     * @param maxlen Size of the buffer
+     * @return Length of the encoding, 0 if it does not fit
+     */
+    size_t base64Encode(const uint8_t *in, size_t in_len, 
+                        char *out, size_t maxlen);
+    
+    /**
+     * @fn establishTransparentClient
+     * @brief Connect to the caster on the multiplexer data channel in
+     *        transparent mode
+     * @return bool type, indicating the status of establishing TCP connection
+     * @retval true Success 
+     * @retval false Failed
+     */
+    bool establishTransparentClient(void);
+    
+    /**
+     * @fn sendRequest
+     * @brief Send data on the open connection and wait for it to be accepted
+     *        without reading past the acknowledgement
+     * @param buf The buffer for data to be send
+     * @param len The length of data to be send
+     * @return bool type, indicating status of sending
+     * @retval true Success 
+     * @retval false Failed
+     */
+    bool sendRequest(const char *buf, size_t len);
+    
+    /**
+     * @fn sendSegments
+     * @brief Send buffers with one AT+CIPSEND or AT+CASEND and wait for
+     *        them to be accepted
+     * @param segments Buffers to send in order
+     * @param count Number of buffers
+     * @return bool type, indicating status of sending
+     * @retval true Success 
+     * @retval false Failed
+     */
+    bool sendSegments(const sendSegment *segments, uint8_t count);
+    
+    /**
+     * @fn closeConnection
+     * @brief Close the TCP connection, leaving the PDP context active
+     * @return bool type, indicating the status of closing the connection
+     * @retval true Success 
+     * @retval false Failed
+     */
+    bool closeConnection(void);
+    
+    /**
+     * @fn activateCAContext
+     * @brief Activate the PDP context used by the CA command set (AT+CNACT)
+     * @return bool type, indicating the status of activating the context
+     * @retval true Success 
+     * @retval false Failed
+     */
+    bool activateCAContext(void);
+    
+    /**
+     * @fn openCAConnection
+     * @brief Open a TCP connection to the caster using AT+CAOPEN, the PDP
+     *        context must be active
+     * @param target Caster host name or address
+     * @return bool type, indicating the status of opening the connection
+     * @retval true Success 
+     * @retval false Failed
+     */
+    bool openCAConnection(const char* target);
+    
+    /**
+     * @fn mqttPublishNow
+     * @brief Publish a message with AT+SMPUB and wait for the result
+     * @return bool type, indicating status of publishing
+     */
+    bool mqttPublishNow(const char* topic,
+                        const char* payload,
+                        uint16_t len,
+                        uint8_t qos,
+                        bool retain);
+    
+    /**
+     * @fn readCA
+     * @brief Read pending data from the CA connection using AT+CARECV
+     * @param buff Buffer to populate with TCP data
+     * @param maxlen Maximum length of data to populate
+     * @return Number of bytes read
+     */
+    uint16_t readCA(char *buff, uint16_t maxlen);
+    
+    /**
+     * @fn readRXGET
+     * @brief Read buffered data in manual receive mode using AT+CIPRXGET=2
+     * @param buff Buffer to populate with TCP data
+     * @param maxlen Maximum length of data to populate
+     * @return Number of bytes read
+     */
+    uint16_t readRXGET(char *buff, uint16_t maxlen);
+    
+    /**
+     * @fn pullTCP
+     * @brief Read data the SIM7000 holds until it is requested, using the
+     *        receive command of the active stack
+     * @param buff Buffer to populate with TCP data
+     * @param maxlen Maximum length of data to populate
+     * @return Number of bytes read
+     */
+    uint16_t pullTCP(char *buff, uint16_t maxlen);
+    
+    /**
+     * @fn expectCmd
+     * @brief Wait for a response with pollCmd() without sending a command
+     * @param resp Desired response from SIM7000
+     * @param err Error response from SIM7000, may be NULL
+     * @param timeout Amount of time (milliseconds) to wait for response
+     */
+    void expectCmd(const char* resp, const char* err, uint32_t timeout);
+    
+    /**
+     * @fn readSocket
+     * @brief Read TCP data that has already arrived, as readAvailable()
+     *        without recording it as received
+     * @param buff Buffer to populate with TCP data
+     * @param maxlen Maximum length of data to populate
+     * @return Number of bytes read
+     */
+    uint16_t readSocket(char *buff, uint16_t maxlen);
+    
+    /**
+     * @fn recordRx
+     * @brief Note TCP data handed to the application for the inactivity
+     *        watchdog, first byte latency and latency tracker
+     * @param buff Data received
+     * @param len Length of data received
+     * @param arrival Time (millis()) the data arrived
+     */
+    void recordRx(const char *buff, uint16_t len, uint32_t arrival);
+    
+    /**
+     * @fn pullAvailable
+     * @brief Advance the receive request of the pull modes, returning any
+     *        data that has arrived
+     * @param buff Buffer to populate with TCP data
+     * @param maxlen Maximum length of data to populate
+     * @return Number of bytes read
+     */
+    uint16_t pullAvailable(char *buff, uint16_t maxlen);
+    
+    /**
+     * @fn readChar
+     * @brief Read a character from SIM7000 serial that is not socket data,
+     *        moving data framed by +IPD headers to the receive buffer
+     * @param c Populated with the character
+     * @return bool type, indicating a character was read
+     */
+    bool readChar(char &c);
+    
+    /**
+     * @fn readNumber
+     * @brief Read a decimal number from SIM7000 serial, consuming the
+     *        character that terminates it
+     * @param timeout Maximum amount of time to read for
+     * @return Value read
+     */
+    uint16_t readNumber(uint32_t timeout = 100);
+    
+    /**
+     * @fn waitFor
+     * @brief Read from SIM7000 serial until a response is seen
+     * @param resp Desired response from SIM7000
+     * @param err Error response from SIM7000, may be NULL
+     * @param timeout Amount of time (milliseconds) to wait for response
+     * @return bool type, indicates if desired response was received
+     * @retval true Desired response received 
+     * @retval false Error response received or timed out
+     */
+    bool waitFor(const char* resp,
+                 const char* err,
+                 uint32_t timeout = 1000);
+    
+    /**
+     * @fn scanURC
+     * @brief Check each received line for connection loss URCs
+     * @param c Character received from SIM7000 serial
+     */
+    void scanURC(char c);
+    
+    /**
+     * @fn parseRegistration
+     * @brief Update the registration status from a +CEREG line
+     * @param line Line starting after "+CEREG: "
+     */
+    void parseRegistration(const char *line);
+    
+    /**
+     * @fn setLinkDown
+     * @brief Record that the link is dead and report it once
+     * @param reason Why the link is dead
+     */
+    void setLinkDown(eLink reason);
+    
+    /**
+     * @fn setLinkUp
+     * @brief Record that a connection was opened
+     */
+    void setLinkUp(void);
+    
+    /**
+     * @fn readClock
+     * @brief Read the SIM7000 real time clock (AT+CCLK?)
+     * @param date Local date as ddmmyy
+     * @param local_time Local time of day (milliseconds)
+     * @param zone Offset of local time from UTC (quarter hours)
+     * @return bool type, indicating the clock was read
+     */
+    bool readClock(uint32_t &date, uint32_t &local_time, int &zone);
+    
+    /**
+     * @fn readExact
+     * @brief Reads an exact number of bytes from SIM7000 serial
+     * @param buffer Buffer to read to
+     * @param length Number of bytes to read
+     * @param timeout Maximum idle time between bytes
+     * @return Number of bytes read
+     */
+    uint16_t readExact(char *buffer,
+                       uint16_t length,
+                       uint32_t timeout = 1000);
+    
+    /**
+     * @fn readLine
+     * @brief Reads the rest of a response line from SIM7000 serial, for
+     *        example after waitFor() has matched its prefix
+     * @param buffer Buffer to read to, null terminated without the line end
+     * @param max_length Size of the buffer, longer lines are truncated
+     * @param timeout Maximum time to wait for the line end
+     * @return bool type, indicating the line end was read
+     */
+    bool readLine(char *buffer,
+                  uint16_t max_length,
+                  uint32_t timeout = 1000);
+    
+    /**
+     * @fn querySetting
+     * @brief Send a query and check whether the setting is enabled
+     * @param cmd Query to send, for example AT+CIPMODE?
+     * @param enabled Response when enabled, for example +CIPMODE: 1
+     * @return bool type, indicating the setting is enabled
+     */
+    bool querySetting(const char* cmd, const char* enabled);
+    
+    /**
+     * @fn checkSendCmd
+     * @brief Send a command to SIM7000 and check response
+     * @param cmd Command to send
+     * @param resp Desired response from SIM7000
+     * @param timeout Amount of time (milliseconds) to wait for response
+     * @return bool type, indicates if desired response was received
+     * @retval true Desired response received 
+     * @retval false Desired response not received
+     */
+    bool checkSendCmd(const char* cmd, 
+                      const char* resp, 
+                      uint32_t timeout = 1000);
+                      
+    /**
+     * @fn sendCmd
+     * @brief Send a command to SIM7000 without checking for response
+     * @param cmd Command to send
      */
     void sendCmd(const char* cmd);
     
@@ -274,7 +1825,9 @@ private:
      * @brief Send a command to SIM7000 without checking for response
      * @param cmd Command to send
      */
+#ifndef TR_SIM7000_NO_ALLOC
      void sendCmd(String cmd);
+#endif
             
     /**
      * @fn checkReadable
@@ -305,7 +1858,7 @@ private:
                         
     int signalRSSI(int signal_quality);
     
-    String getSignalQualityDescriptor(int signal_quality);
+    const char* getSignalQualityDescriptor(int signal_quality);
     
 };
 
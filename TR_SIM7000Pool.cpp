@@ -0,0 +1,650 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/
+
+#include <TR_SIM7000Pool.h>
+#include <TR_NoAlloc.h>
+
+// Consecutive failed probes or sends before a modem is considered down
+#define TR_POOL_MAX_FAILURES 3
+
+TR_SIM7000Pool::TR_SIM7000Pool()
+{}
+
+bool TR_SIM7000Pool::addModem(TR_SIM7000 &modem)
+{
+    if(num_members == TR_POOL_MAX_MODEMS)
+    {
+        return false;
+    }
+    
+    poolMember *member = &members[num_members];
+    
+    // Without +IPD headers a probe or send would consume correction data
+    if(modem.tcp_stack == TR_SIM7000::eCIP && !modem.manual_rx && modem.data_port == NULL)
+    {
+        if(!modem.setReceiveBuffer(member->rx_buffer, sizeof(member->rx_buffer)))
+        {
+            return false;
+        }
+    }
+    
+    num_members++;
+    member->modem = &modem;
+    member->state = eIdle;
+    member->healthy = true;
+    member->failures = 0;
+    member->latency = 0;
+    member->last_probe = millis();
+    member->last_rx = millis();
+    member->sent_bytes = 0;
+    member->tx_len = 0;
+    member->reg_reports = 0;
+    return true;
+}
+
+void TR_SIM7000Pool::setHealthCheck(uint32_t probe_interval_in,
+                                    uint32_t stall_timeout_in)
+{
+    probe_interval = probe_interval_in;
+    stall_timeout = stall_timeout_in;
+}
+
+void TR_SIM7000Pool::setHotStandby(bool enable)
+{
+    hot_standby = enable;
+}
+
+void TR_SIM7000Pool::poll(void)
+{
+    for(uint8_t i = 0; i < num_members; i++)
+    {
+        pollMember(i);
+    }
+    
+    if(active < 0 || !members[active].healthy)
+    {
+        failover();
+    }
+}
+
+bool TR_SIM7000Pool::send(const char *buf, size_t len)
+{
+    if(len > TR_POOL_TX_MAX)
+    {
+        return false;
+    }
+    
+    // Pick the idle healthy modem with the lowest latency, sending on the
+    // correction source interrupts its stream so it is used last
+    int8_t best = -1;
+    for(uint8_t i = 0; i < num_members; i++)
+    {
+        poolMember *member = &members[i];
+        if(!member->healthy || member->state != eIdle)
+        {
+            continue;
+        }
+        if(best < 0)
+        {
+            best = i;
+            continue;
+        }
+        
+        bool best_streaming = isStreaming(best);
+        bool streaming = isStreaming(i);
+        if(best_streaming != streaming)
+        {
+            if(best_streaming)
+            {
+                best = i;
+            }
+        }
+        else if(member->latency < members[best].latency)
+        {
+            best = i;
+        }
+    }
+    
+    if(best < 0)
+    {
+        return false;
+    }
+    
+    poolMember *member = &members[best];
+    TR_SIM7000 *modem = member->modem;
+    char send_command[32];
+    if(modem->tcp_stack == TR_SIM7000::eCA)
+    {
+        sprintf(send_command, "AT+CASEND=%d,%d\r\n", modem->ca_cid, (int)len);
+    }
+    else
+    {
+        sprintf(send_command, "AT+CIPSEND=%d\r\n", (int)len);
+    }
+    
+    if(!modem->startCmd(send_command, ">", "ERROR", 1000))
+    {
+        return false;
+    }
+    
+    memcpy(member->tx_buffer, buf, len);
+    member->tx_len = len;
+    member->op_start = millis();
+    member->state = eSendPrompt;
+    return true;
+}
+
+uint16_t TR_SIM7000Pool::readCorrections(char *buff, uint16_t maxlen)
+{
+    // Probes and sends pass correction data through, connecting does not
+    if(active < 0 || members[active].state >= eConnectStart)
+    {
+        return 0;
+    }
+    
+    uint16_t len = members[active].modem->readAvailable(buff, maxlen);
+    if(len > 0)
+    {
+        members[active].last_rx = millis();
+    }
+    return len;
+}
+
+int8_t TR_SIM7000Pool::getActive(void)
+{
+    return active;
+}
+
+bool TR_SIM7000Pool::isHealthy(uint8_t index)
+{
+    return (index < num_members) && members[index].healthy;
+}
+
+uint32_t TR_SIM7000Pool::getLatency(uint8_t index)
+{
+    return (index < num_members) ? members[index].latency : 0;
+}
+
+uint32_t TR_SIM7000Pool::getSentBytes(uint8_t index)
+{
+    return (index < num_members) ? members[index].sent_bytes : 0;
+}
+
+uint32_t TR_SIM7000Pool::getFailovers(void)
+{
+    return failovers;
+}
+
+bool TR_SIM7000Pool::isStreaming(uint8_t index)
+{
+    return (index == active) || (hot_standby && members[index].healthy);
+}
+
+void TR_SIM7000Pool::pollMember(uint8_t index)
+{
+    poolMember *member = &members[index];
+    TR_SIM7000 *modem = member->modem;
+    uint32_t now = millis();
+    TR_SIM7000::eCmd result;
+    char command[96];
+    
+    switch(member->state)
+    {
+        case eIdle:
+            if(isStreaming(index))
+            {
+                // Probing a streaming modem would mix status responses into
+                // the corrections, so data flow is its health check
+                if(index != active)
+                {
+                    if(modem->readAvailable(discard, sizeof(discard)) > 0)
+                    {
+                        member->last_rx = now;
+                    }
+                }
+                if((now - member->last_rx) > stall_timeout)
+                {
+                    Serial.print("Modem ");Serial.print(index);
+                    Serial.println(" correction stream stalled");
+                    member->healthy = false;
+                }
+                else if(modem->checkLink() != TR_SIM7000::eLinkUp)
+                {
+                    Serial.print("Modem ");Serial.print(index);
+                    Serial.println(" correction stream closed");
+                    member->healthy = false;
+                }
+            }
+            else if((now - member->last_probe) > probe_interval)
+            {
+                // Modems without a stream have no socket to check, so the
+                // probe is a round trip and a look at network registration
+                if(modem->startCmd("AT+CEREG?\r\n", "OK", "ERROR", 1000))
+                {
+                    member->reg_reports = modem->reg_reports;
+                    member->op_start = now;
+                    member->last_probe = now;
+                    member->state = eProbe;
+                }
+            }
+            break;
+            
+        case eProbe:
+            result = modem->pollCmd();
+            if(result == TR_SIM7000::eCmdOK || result == TR_SIM7000::eCmdFail)
+            {
+                member->state = eIdle;
+                // Registration counts only if this reply reported it
+                bool registered = (modem->reg_reports != member->reg_reports &&
+                                   (modem->reg_state == TR_SIM7000::eRegHome ||
+                                    modem->reg_state == TR_SIM7000::eRegRoaming));
+                recordResult(index, result == TR_SIM7000::eCmdOK && registered,
+                             now - member->op_start);
+                
+                // A recovered modem restarts its stall timer
+                member->last_rx = now;
+                
+                // A recovered standby modem needs its stream back
+                if(hot_standby && member->healthy &&
+                   modem->checkLink() != TR_SIM7000::eLinkUp)
+                {
+                    member->healthy = false;
+                    startConnect(index);
+                }
+            }
+            break;
+            
+        case eSendPrompt:
+            result = modem->pollCmd();
+            if(result == TR_SIM7000::eCmdOK)
+            {
+                modem->sim7000Serial->write((const uint8_t*)member->tx_buffer,
+                                            member->tx_len);
+                if(modem->tcp_stack == TR_SIM7000::eCA)
+                {
+                    modem->startCmd("", "OK", "ERROR", 5000);
+                }
+                else
+                {
+                    modem->startCmd("", "SEND OK", "SEND FAIL", 5000);
+                }
+                member->state = eSendWait;
+            }
+            else if(result == TR_SIM7000::eCmdFail)
+            {
+                member->state = eIdle;
+                recordResult(index, false, now - member->op_start);
+            }
+            break;
+            
+        case eSendWait:
+            result = modem->pollCmd();
+            if(result == TR_SIM7000::eCmdOK || result == TR_SIM7000::eCmdFail)
+            {
+                member->state = eIdle;
+                if(result == TR_SIM7000::eCmdOK)
+                {
+                    member->sent_bytes += member->tx_len;
+                }
+                recordResult(index, result == TR_SIM7000::eCmdOK, now - member->op_start);
+            }
+            break;
+            
+        case eConnectStart:
+            // The SIM7000 refuses a second connection, drop the old one
+            if(modem->tcp_stack == TR_SIM7000::eCA)
+            {
+                sprintf(command, "AT+CACLOSE=%d\r\n", modem->ca_cid);
+            }
+            else
+            {
+                strcpy(command, "AT+CIPCLOSE=1\r\n");
+            }
+            if(modem->startCmd(command, "OK", "ERROR", 2000))
+            {
+                member->op_start = now;
+                member->state = eConnectClose;
+            }
+            else if((now - member->op_start) > 2000)
+            {
+                // Still busy with a receive request
+                connectFailed(index);
+            }
+            break;
+            
+        case eConnectClose:
+            // No connection to close is not an error
+            if(modem->pollCmd() == TR_SIM7000::eCmdPending)
+            {
+                break;
+            }
+            
+            // Refresh a missing or stale address for later connections,
+            // the result arrives as a URC after OK
+            if(modem->lookupDue(modem->host))
+            {
+                sprintf(command, "AT+CDNSGIP=\"%s\"\r\n", modem->host);
+                modem->startLookup(modem->host);
+                if(modem->startCmd(command, "OK", "ERROR", 2000))
+                {
+                    member->state = eConnectLookup;
+                    break;
+                }
+                modem->findDNS(modem->host, false)->pending = false;
+            }
+            startOpen(index);
+            break;
+            
+        case eConnectLookup:
+            result = modem->pollCmd();
+            if(result == TR_SIM7000::eCmdPending)
+            {
+                break;
+            }
+            if(result == TR_SIM7000::eCmdFail)
+            {
+                modem->findDNS(modem->host, false)->pending = false;
+            }
+            startOpen(index);
+            break;
+            
+        case eConnectOpen:
+            result = modem->pollCmd();
+            if(result == TR_SIM7000::eCmdFail)
+            {
+                connectFailed(index);
+            }
+            else if(result == TR_SIM7000::eCmdOK)
+            {
+                if(modem->tcp_stack == TR_SIM7000::eCA)
+                {
+                    member->op_start = now;
+                    member->state = eConnectResult;
+                }
+                else
+                {
+                    startRequest(index);
+                }
+            }
+            break;
+            
+        case eConnectResult:
+            // Response is +CAOPEN: <cid>,<result> with result 0 on success
+            if(modem->sim7000Serial->available() >= 3)
+            {
+                char open_resp[3];
+                modem->readExact(open_resp, 3, 100);
+                if(open_resp[2] == '0')
+                {
+                    startRequest(index);
+                }
+                else
+                {
+                    connectFailed(index);
+                }
+            }
+            else if((now - member->op_start) > 1000)
+            {
+                connectFailed(index);
+            }
+            break;
+            
+        case eConnectPrompt:
+            result = modem->pollCmd();
+            if(result == TR_SIM7000::eCmdFail)
+            {
+                connectFailed(index);
+            }
+            else if(result == TR_SIM7000::eCmdOK)
+            {
+                modem->sim7000Serial->write((const uint8_t*)member->tx_buffer,
+                                            member->tx_len);
+                if(modem->tcp_stack == TR_SIM7000::eCA)
+                {
+                    modem->startCmd("", "OK", "ERROR", 5000);
+                }
+                else
+                {
+                    modem->startCmd("", "SEND OK", "SEND FAIL", 5000);
+                }
+                member->state = eConnectSend;
+            }
+            break;
+            
+        case eConnectSend:
+            result = modem->pollCmd();
+            if(result == TR_SIM7000::eCmdFail)
+            {
+                connectFailed(index);
+            }
+            else if(result == TR_SIM7000::eCmdOK)
+            {
+                // The reply line is collected in the transmit buffer
+                modem->setLinkUp();
+                member->tx_len = 0;
+                member->op_start = now;
+                member->state = eConnectReply;
+            }
+            break;
+            
+        case eConnectReply:
+            // A caster that accepts the connection but never answers is a
+            // failure
+            while(modem->readSocket(command, 1) == 1)
+            {
+                if(command[0] != '\n')
+                {
+                    if(member->tx_len < TR_POOL_TX_MAX)
+                    {
+                        member->tx_buffer[member->tx_len++] = command[0];
+                    }
+                    continue;
+                }
+                
+                // Only the reply line is read, corrections follow it
+                if(member->tx_len >= 10 && 0 == strncmp(member->tx_buffer, "ICY 200 OK", 10))
+                {
+                    Serial.print("Modem ");Serial.print(index);
+                    Serial.println(" connected to caster");
+                    member->state = eIdle;
+                    member->healthy = true;
+                    member->failures = 0;
+                    member->last_rx = now;
+                    member->last_probe = now;
+                }
+                else
+                {
+                    Serial.print("Modem ");Serial.print(index);
+                    Serial.println(" connection rejected");
+                    connectFailed(index);
+                }
+                return;
+            }
+            if((now - member->op_start) > 10000)
+            {
+                connectFailed(index);
+            }
+            break;
+    }
+}
+
+void TR_SIM7000Pool::recordResult(uint8_t index, bool success, uint32_t elapsed)
+{
+    poolMember *member = &members[index];
+    
+    if(!success)
+    {
+        member->failures++;
+        if(member->failures >= TR_POOL_MAX_FAILURES)
+        {
+            member->healthy = false;
+        }
+        return;
+    }
+    
+    member->failures = 0;
+    member->healthy = true;
+    
+    // Exponentially smoothed latency
+    if(member->latency == 0)
+    {
+        member->latency = elapsed;
+    }
+    else
+    {
+        member->latency = ((member->latency * 7) + elapsed) / 8;
+    }
+}
+
+void TR_SIM7000Pool::failover(void)
+{
+    int8_t previous = active;
+    
+    // Healthy idle modem with the lowest latency
+    int8_t best = -1;
+    for(uint8_t i = 0; i < num_members; i++)
+    {
+        if(!members[i].healthy || members[i].state != eIdle)
+        {
+            continue;
+        }
+        if(best < 0 || members[i].latency < members[best].latency)
+        {
+            best = i;
+        }
+    }
+    
+    active = best;
+    if(best < 0)
+    {
+        return;
+    }
+    
+    // Hot standby modems already have a stream open, otherwise the new
+    // source stays healthy while it connects over the next calls to poll()
+    if(!hot_standby)
+    {
+        startConnect(best);
+    }
+    
+    members[active].last_rx = millis();
+    if(active != previous)
+    {
+        failovers++;
+        Serial.print("Corrections failed over to modem ");
+        Serial.println(active);
+    }
+}
+
+void TR_SIM7000Pool::startConnect(uint8_t index)
+{
+    poolMember *member = &members[index];
+    member->op_start = millis();
+    member->state = eConnectStart;
+}
+
+void TR_SIM7000Pool::startOpen(uint8_t index)
+{
+    poolMember *member = &members[index];
+    TR_SIM7000 *modem = member->modem;
+    
+    // Connect by cached address, waiting for a lookup here would block
+    const char *target = modem->cachedAddress(modem->host);
+    char command[96];
+    int len;
+    if(modem->tcp_stack == TR_SIM7000::eCA)
+    {
+        len = snprintf(command, sizeof(command),
+                       "AT+CAOPEN=%d,\"TCP\",\"%s\",%d\r\n",
+                       modem->ca_cid, target, modem->tcp_port);
+    }
+    else
+    {
+        len = snprintf(command, sizeof(command),
+                       "AT+CIPSTART=\"TCP\",\"%s\",%d\r\n",
+                       target, modem->tcp_port);
+    }
+    if(len < 0 || len >= (int)sizeof(command) ||
+       !modem->startCmd(command,
+                        (modem->tcp_stack == TR_SIM7000::eCA) ? "+CAOPEN: " : "CONNECT OK",
+                        "CONNECT FAIL",
+                        TR_CONNECT_TIMEOUT))
+    {
+        connectFailed(index);
+        return;
+    }
+    member->op_start = millis();
+    member->state = eConnectOpen;
+}
+
+void TR_SIM7000Pool::startRequest(uint8_t index)
+{
+    poolMember *member = &members[index];
+    TR_SIM7000 *modem = member->modem;
+    
+    size_t request_len = modem->ntripRequest(member->tx_buffer, sizeof(member->tx_buffer));
+    if(request_len == 0)
+    {
+        Serial.println("NTRIP request too long");
+        connectFailed(index);
+        return;
+    }
+    member->tx_len = request_len;
+    
+    char send_command[32];
+    if(modem->tcp_stack == TR_SIM7000::eCA)
+    {
+        sprintf(send_command, "AT+CASEND=%d,%d\r\n", modem->ca_cid, (int)request_len);
+    }
+    else
+    {
+        sprintf(send_command, "AT+CIPSEND=%d\r\n", (int)request_len);
+    }
+    
+    if(!modem->startCmd(send_command, ">", "ERROR", 1000))
+    {
+        connectFailed(index);
+        return;
+    }
+    member->state = eConnectPrompt;
+}
+
+void TR_SIM7000Pool::connectFailed(uint8_t index)
+{
+    poolMember *member = &members[index];
+    
+    Serial.print("Modem ");Serial.print(index);
+    Serial.println(" failed to connect to caster");
+    
+    // Probes bring the modem back once the interval has passed
+    member->state = eIdle;
+    member->healthy = false;
+    member->failures = TR_POOL_MAX_FAILURES;
+    member->last_probe = millis();
+}
@@ -0,0 +1,267 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_SIM7000POOL_H_
+#define _TR_SIM7000POOL_H_
+
+#include "Arduino.h"
+#include "TR_SIM7000.h"
+
+// Number of modems a pool can manage
+#ifndef TR_POOL_MAX_MODEMS
+#define TR_POOL_MAX_MODEMS 4
+#endif
+
+// Largest outbound message, matches the SIM7000 single send limit
+#define TR_POOL_TX_MAX 1460
+
+// Correction data each modem keeps while a probe or send is running
+#ifndef TR_POOL_RX_BUFFER
+#define TR_POOL_RX_BUFFER 256
+#endif
+
+class TR_SIM7000Pool
+{
+    public:
+    
+    /**
+     * @fn TR_SIM7000Pool
+     * @brief Modem pool constructor
+     * @return None
+     */
+    TR_SIM7000Pool();
+    
+   /**
+    * @fn addModem
+    * @brief Add an initialized and connected modem to the pool, the first
+    *        modem added is the initial correction source
+    * @details Modems on the eCIP stack in push mode are given a receive
+    *          buffer so correction data arriving during a probe or send is
+    *          kept for readCorrections().
+    * @param modem Modem to add
+    * @return bool type, indicating the modem was added
+    * @retval true Success 
+    * @retval false Pool is full or the receive buffer could not be set
+    */
+    bool addModem(TR_SIM7000 &modem);
+    
+   /**
+    * @fn setHealthCheck
+    * @brief Configure health checking
+    * @param probe_interval_in Time (milliseconds) between status probes of
+    *        modems that are not streaming corrections
+    * @param stall_timeout_in Time (milliseconds) without correction data
+    *        before a streaming modem is considered down
+    */
+    void setHealthCheck(uint32_t probe_interval_in,
+                        uint32_t stall_timeout_in);
+    
+   /**
+    * @fn setHotStandby
+    * @brief Keep correction streams open on all healthy modems so failover
+    *        does not need a new caster connection. Data from standby modems
+    *        is read and discarded, a standby modem that lost its stream is
+    *        reconnected once it passes a probe. When disabled, failover
+    *        connects the new source over the following calls to poll().
+    *        A new connection is checked for the caster's ICY 200 OK reply,
+    *        which is not passed on to readCorrections().
+    * @param enable true to enable hot standby
+    */
+    void setHotStandby(bool enable);
+    
+   /**
+    * @fn poll
+    * @brief Advance probes and sends on all modems and handle failover,
+    *        call frequently from loop()
+    */
+    void poll(void);
+    
+   /**
+    * @fn send
+    * @brief Queue data on the healthy idle modem with the lowest latency,
+    *        preferring modems that are not streaming corrections
+    * @param buf The buffer for data to be send, copied by the pool
+    * @param len The length of data to be send
+    * @return bool type, indicating the data was queued
+    * @retval true Success 
+    * @retval false No modem available, try again after poll()
+    */
+    bool send(const char *buf, size_t len);
+    
+   /**
+    * @fn readCorrections
+    * @brief Read correction data from the active source
+    * @param buff Buffer to populate with TCP data
+    * @param maxlen Maximum length of data to populate
+    * @return Number of bytes read
+    */
+    uint16_t readCorrections(char *buff, uint16_t maxlen);
+    
+   /**
+    * @fn getActive
+    * @brief Index of the modem supplying corrections
+    * @return Modem index or -1 when no modem is healthy
+    */
+    int8_t getActive(void);
+    
+   /**
+    * @fn isHealthy
+    * @brief Health of a modem
+    * @param index Modem index in the order added
+    * @return bool type, indicating the modem is healthy
+    */
+    bool isHealthy(uint8_t index);
+    
+   /**
+    * @fn getLatency
+    * @brief Smoothed command round trip or send time of a modem
+    * @param index Modem index in the order added
+    * @return Latency in milliseconds
+    */
+    uint32_t getLatency(uint8_t index);
+    
+   /**
+    * @fn getSentBytes
+    * @brief Bytes sent through a modem
+    * @param index Modem index in the order added
+    * @return Byte count
+    */
+    uint32_t getSentBytes(uint8_t index);
+    
+   /**
+    * @fn getFailovers
+    * @brief Number of times the correction source changed
+    * @return Failover count
+    */
+    uint32_t getFailovers(void);
+
+    private:
+    
+    typedef enum
+    {
+        eIdle,
+        eProbe,
+        eSendPrompt,
+        eSendWait,
+        
+        // Caster connection steps, these read the SIM7000 directly
+        eConnectStart,
+        eConnectClose,
+        eConnectLookup,
+        eConnectOpen,
+        eConnectResult,
+        eConnectPrompt,
+        eConnectSend,
+        eConnectReply,
+    }eState;
+    
+    // Pool member state
+    typedef struct
+    {
+        TR_SIM7000 *modem;
+        eState state;
+        bool healthy;
+        uint8_t failures;
+        uint32_t latency;
+        uint32_t last_probe;
+        uint32_t last_rx;
+        uint32_t op_start;
+        uint32_t sent_bytes;
+        uint32_t reg_reports;
+        char tx_buffer[TR_POOL_TX_MAX];
+        uint16_t tx_len;
+        char rx_buffer[TR_POOL_RX_BUFFER];
+    }poolMember;
+    
+    poolMember members[TR_POOL_MAX_MODEMS];
+    uint8_t num_members = 0;
+    
+    // Modem supplying corrections
+    int8_t active = 0;
+    
+    uint32_t probe_interval = 5000;
+    uint32_t stall_timeout = 10000;
+    bool hot_standby = false;
+    uint32_t failovers = 0;
+    
+    // Scratch for discarding data from hot standby modems
+    char discard[64];
+    
+    /**
+     * @fn isStreaming
+     * @brief Check whether a modem is receiving a correction stream
+     */
+    bool isStreaming(uint8_t index);
+    
+    /**
+     * @fn pollMember
+     * @brief Advance the probe or send in progress on a modem
+     */
+    void pollMember(uint8_t index);
+    
+    /**
+     * @fn recordResult
+     * @brief Update health and latency after a probe or send completes
+     */
+    void recordResult(uint8_t index, bool success, uint32_t elapsed);
+    
+    /**
+     * @fn failover
+     * @brief Switch corrections to the healthy modem with lowest latency
+     */
+    void failover(void);
+    
+    /**
+     * @fn startConnect
+     * @brief Begin connecting a modem to the caster, the steps are advanced
+     *        by pollMember()
+     */
+    void startConnect(uint8_t index);
+    
+    /**
+     * @fn startOpen
+     * @brief Open the connection by cached address, or by host name when
+     *        none is cached
+     */
+    void startOpen(uint8_t index);
+    
+    /**
+     * @fn startRequest
+     * @brief Send the NTRIP request on a newly opened connection
+     */
+    void startRequest(uint8_t index);
+    
+    /**
+     * @fn connectFailed
+     * @brief Mark a modem down after a failed connection step
+     */
+    void connectFailed(uint8_t index);
+};
+
+#endif
@@ -0,0 +1,239 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/
+
+#include <TR_SIM7000Task.h>
+#include <TR_NoAlloc.h>
+
+#if TR_SIM7000_HAS_ATOMIC
+
+TR_QueuedStream::TR_QueuedStream(Stream &port_in)
+{
+    port = &port_in;
+}
+
+bool TR_QueuedStream::pushRx(uint8_t c)
+{
+    if(!rx_queue.push(c))
+    {
+        overflows++;
+        return false;
+    }
+    return true;
+}
+
+void TR_QueuedStream::pumpRx(void)
+{
+    while(port->available())
+    {
+        pushRx((uint8_t)port->read());
+    }
+}
+
+uint32_t TR_QueuedStream::getOverflows(void)
+{
+    return overflows;
+}
+
+int TR_QueuedStream::available(void)
+{
+    return rx_queue.available();
+}
+
+int TR_QueuedStream::read(void)
+{
+    uint8_t c;
+    if(!rx_queue.pop(c))
+    {
+        return -1;
+    }
+    return c;
+}
+
+int TR_QueuedStream::peek(void)
+{
+    uint8_t c;
+    if(!rx_queue.peek(c))
+    {
+        return -1;
+    }
+    return c;
+}
+
+size_t TR_QueuedStream::write(uint8_t c)
+{
+    return port->write(c);
+}
+
+size_t TR_QueuedStream::write(const uint8_t *buffer, size_t size)
+{
+    return port->write(buffer, size);
+}
+
+void TR_QueuedStream::flush(void)
+{
+    port->flush();
+}
+
+TR_SIM7000Task::TR_SIM7000Task(TR_SIM7000 &modem_in)
+{
+    modem = &modem_in;
+}
+
+bool TR_SIM7000Task::submitSend(modemRequest &req,
+                                const char *buf,
+                                size_t len)
+{
+    req.type = eRequestSend;
+    req.data = buf;
+    req.len = len;
+    req.resp = NULL;
+    req.reply = NULL;
+    req.reply_len = 0;
+    req.timeout = 0;
+    return submit(&req);
+}
+
+bool TR_SIM7000Task::submitCommand(modemRequest &req,
+                                   const char *cmd,
+                                   const char *resp,
+                                   uint32_t timeout,
+                                   char *reply,
+                                   uint16_t reply_len)
+{
+    req.type = eRequestCommand;
+    req.data = cmd;
+    req.len = strlen(cmd);
+    req.resp = resp;
+    req.reply = reply;
+    req.reply_len = reply_len;
+    req.timeout = timeout;
+    return submit(&req);
+}
+
+bool TR_SIM7000Task::wait(modemRequest &req, uint32_t timeout)
+{
+    uint32_t start = millis();
+    while(req.status.load(std::memory_order_acquire) == eQueued)
+    {
+        if((millis() - start) > timeout)
+        {
+            return false;
+        }
+        // Lets the scheduler run the driver task
+        delay(1);
+    }
+    return req.status.load(std::memory_order_acquire) == eDone;
+}
+
+void TR_SIM7000Task::run(void)
+{
+    // Requests wait while readAvailable() has a receive request running
+    modemRequest *req;
+    while(modem->pull_state == TR_SIM7000::ePullIdle && requests.pop(req))
+    {
+        bool success = execute(req);
+        req->status.store(success ? eDone : eFailed, std::memory_order_release);
+        
+        // A steady flow of requests must not hold up the corrections
+        queueCorrections();
+    }
+    
+    queueCorrections();
+}
+
+uint16_t TR_SIM7000Task::readCorrections(char *buff, uint16_t maxlen)
+{
+    return corrections.pop(buff, maxlen);
+}
+
+uint32_t TR_SIM7000Task::getCorrectionOverflows(void)
+{
+    return correction_overflows;
+}
+
+bool TR_SIM7000Task::submit(modemRequest *req)
+{
+    req->status.store(eQueued, std::memory_order_relaxed);
+    
+    // Several application threads share the producer side, a waiting thread
+    // gives up its time slice so the holder can finish
+    while(submit_lock.test_and_set(std::memory_order_acquire))
+    {
+        delay(1);
+    }
+    bool queued = requests.push(req);
+    submit_lock.clear(std::memory_order_release);
+    
+    // A request that never reached the driver task must not look pending
+    if(!queued)
+    {
+        req->status.store(eFailed, std::memory_order_release);
+    }
+    return queued;
+}
+
+void TR_SIM7000Task::queueCorrections(void)
+{
+    // A full chunk means more may be waiting, data kept during a command
+    // can be larger than one chunk
+    uint16_t len;
+    do
+    {
+        len = modem->readAvailable(rx_chunk, sizeof(rx_chunk));
+        if(len > 0)
+        {
+            size_t queued = corrections.push(rx_chunk, len);
+            if(queued < len)
+            {
+                correction_overflows += len - queued;
+            }
+        }
+    }
+    while(len == sizeof(rx_chunk));
+}
+
+bool TR_SIM7000Task::execute(modemRequest *req)
+{
+    if(req->type == eRequestSend)
+    {
+        return modem->send((char*)req->data, req->len);
+    }
+    
+    if(req->reply == NULL || req->reply_len == 0)
+    {
+        return modem->checkSendCmd(req->data, req->resp, req->timeout);
+    }
+    
+    modem->cleanBuffer(req->reply, req->reply_len);
+    modem->sendCmd(req->data);
+    modem->readBuffer(req->reply, req->reply_len - 1, req->timeout);
+    return NULL != strstr(req->reply, req->resp);
+}
+
+#endif
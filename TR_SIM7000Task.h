@@ -0,0 +1,285 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_SIM7000TASK_H_
+#define _TR_SIM7000TASK_H_
+
+#include "Arduino.h"
+#include "TR_SIM7000.h"
+#include "TR_SPSCQueue.h"
+
+#if TR_SIM7000_HAS_ATOMIC
+
+// Bytes buffered between the UART ISR or RX task and the driver task
+#ifndef TR_TASK_RX_QUEUE
+#define TR_TASK_RX_QUEUE 1024
+#endif
+
+// Bytes of correction data buffered between the driver task and application
+#ifndef TR_TASK_CORRECTION_QUEUE
+#define TR_TASK_CORRECTION_QUEUE 4096
+#endif
+
+// Requests waiting for the driver task
+#ifndef TR_TASK_REQUEST_QUEUE
+#define TR_TASK_REQUEST_QUEUE 8
+#endif
+
+/**
+ * @class TR_QueuedStream
+ * @brief Stream for TR_SIM7000 whose receive side is fed from a UART ISR or
+ *        RX task through a lock free queue. Writes go straight to the port
+ *        and must only come from the driver task.
+ */
+class TR_QueuedStream : public Stream
+{
+    public:
+    
+    /**
+     * @fn TR_QueuedStream
+     * @brief Queued stream constructor
+     * @param port_in SIM7000 serial port
+     * @return None
+     */
+    TR_QueuedStream(Stream &port_in);
+    
+   /**
+    * @fn pushRx
+    * @brief Queue a received byte, call from the UART ISR
+    * @param c Received byte
+    * @return bool type, indicating the byte was queued
+    * @retval true Success 
+    * @retval false Queue full, byte dropped
+    */
+    bool pushRx(uint8_t c);
+    
+   /**
+    * @fn pumpRx
+    * @brief Move all bytes the port has received into the queue, call from
+    *        a dedicated RX task when no UART ISR hook is available
+    */
+    void pumpRx(void);
+    
+   /**
+    * @fn getOverflows
+    * @brief Number of received bytes dropped because the queue was full
+    * @return Byte count
+    */
+    uint32_t getOverflows(void);
+    
+    int available(void) override;
+    int read(void) override;
+    int peek(void) override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    void flush(void) override;
+    using Print::write;
+    
+    private:
+    
+    // Serial port (passed in on construction) for communicating with SIM7000
+    Stream *port;
+    
+    TR_SPSCQueue<uint8_t, TR_TASK_RX_QUEUE> rx_queue;
+    
+    volatile uint32_t overflows = 0;
+};
+
+/**
+ * @class TR_SIM7000Task
+ * @brief Runs a TR_SIM7000 on its own core, task or thread. Application
+ *        threads submit send and command requests which the driver task
+ *        executes in order, and read correction data the driver task has
+ *        queued. run() is called in a loop by the driver task only.
+ * @note Correction data that arrives while a command is executing is read
+ *       as part of its response, set a receive buffer with
+ *       TR_SIM7000::setReceiveBuffer(), enable manual receive mode or use
+ *       the CA stack so socket data is kept apart from responses.
+ */
+class TR_SIM7000Task
+{
+    public:
+    
+    /**
+      * @enum eRequest
+      * @brief Type of request for the driver task
+      */
+      typedef enum
+      {
+          eRequestSend,
+          eRequestCommand,
+      }eRequest;
+      
+    /**
+      * @enum eStatus
+      * @brief Progress of a request
+      */
+      typedef enum
+      {
+          eQueued,
+          eDone,
+          eFailed,
+      }eStatus;
+      
+    // Request owned by the submitting thread until it leaves eQueued, the
+    // driver task still uses it after wait() times out
+    typedef struct
+    {
+        eRequest type;
+        const char* data;
+        size_t len;
+        const char* resp;
+        char* reply;
+        uint16_t reply_len;
+        uint32_t timeout;
+        std::atomic<uint8_t> status;
+    }modemRequest;
+    
+    /**
+     * @fn TR_SIM7000Task
+     * @brief Driver task constructor
+     * @param modem_in Modem initialized with a TR_QueuedStream
+     * @return None
+     */
+    TR_SIM7000Task(TR_SIM7000 &modem_in);
+    
+   /**
+    * @fn submitSend
+    * @brief Queue data to send on the TCP connection
+    * @param req Request to fill in, must stay valid until it completes
+    * @param buf The buffer for data to be send, must stay valid until the
+    *        request completes
+    * @param len The length of data to be send
+    * @return bool type, indicating the request was queued
+    * @retval true Success 
+    * @retval false Request queue full, the request is marked eFailed
+    */
+    bool submitSend(modemRequest &req,
+                    const char *buf,
+                    size_t len);
+    
+   /**
+    * @fn submitCommand
+    * @brief Queue an AT command
+    * @param req Request to fill in, must stay valid until it completes
+    * @param cmd Command to send, must stay valid until the request completes
+    * @param resp Desired response from SIM7000
+    * @param timeout Amount of time (milliseconds) to wait for response
+    * @param reply Optional buffer populated with the response
+    * @param reply_len Size of reply buffer
+    * @return bool type, indicating the request was queued
+    * @retval true Success 
+    * @retval false Request queue full, the request is marked eFailed
+    */
+    bool submitCommand(modemRequest &req,
+                       const char *cmd,
+                       const char *resp,
+                       uint32_t timeout = 1000,
+                       char *reply = NULL,
+                       uint16_t reply_len = 0);
+    
+   /**
+    * @fn wait
+    * @brief Wait for a request to complete
+    * @note A request that times out is still queued or executing. It and
+    *       the buffers it points to must stay valid until its status
+    *       leaves eQueued, so wait again before they go out of scope.
+    *       There is no way to cancel a queued request, the driver task
+    *       reads it when it reaches the front of the queue.
+    * @param req Request to wait for
+    * @param timeout Maximum amount of time (milliseconds) to wait
+    * @return bool type, indicating the request succeeded
+    * @retval true Success 
+    * @retval false Failed or timed out, check req.status for eQueued
+    */
+    bool wait(modemRequest &req, uint32_t timeout);
+    
+   /**
+    * @fn run
+    * @brief Execute queued requests then queue any correction data that has
+    *        arrived, called repeatedly by the driver task
+    */
+    void run(void);
+    
+   /**
+    * @fn readCorrections
+    * @brief Read correction data queued by the driver task, called by a
+    *        single application thread
+    * @param buff Buffer to populate with TCP data
+    * @param maxlen Maximum length of data to populate
+    * @return Number of bytes read
+    */
+    uint16_t readCorrections(char *buff, uint16_t maxlen);
+    
+   /**
+    * @fn getCorrectionOverflows
+    * @brief Number of correction bytes dropped because the application did
+    *        not read them in time
+    * @return Byte count
+    */
+    uint32_t getCorrectionOverflows(void);
+    
+    private:
+    
+    TR_SIM7000 *modem;
+    
+    // Requests from application threads, producers serialize on the lock
+    // and sleep rather than spin while another thread holds it
+    TR_SPSCQueue<modemRequest*, TR_TASK_REQUEST_QUEUE> requests;
+    std::atomic_flag submit_lock = ATOMIC_FLAG_INIT;
+    
+    // Correction data from the driver task to the application
+    TR_SPSCQueue<char, TR_TASK_CORRECTION_QUEUE> corrections;
+    uint32_t correction_overflows = 0;
+    
+    // Chunk read from the modem each run()
+    char rx_chunk[256];
+    
+    /**
+     * @fn submit
+     * @brief Queue a request from any application thread
+     */
+    bool submit(modemRequest *req);
+    
+    /**
+     * @fn queueCorrections
+     * @brief Move correction data that has arrived to the application queue
+     */
+    void queueCorrections(void);
+    
+    /**
+     * @fn execute
+     * @brief Execute a request on the driver task
+     */
+    bool execute(modemRequest *req);
+};
+
+#endif
+
+#endif
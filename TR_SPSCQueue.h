@@ -0,0 +1,192 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_SPSCQUEUE_H_
+#define _TR_SPSCQUEUE_H_
+
+#include <stddef.h>
+
+// AVR and other toolchains without the C++ standard library have no
+// <atomic>, the queue and TR_SIM7000Task are left out of those builds
+#ifndef TR_SIM7000_HAS_ATOMIC
+#if defined(__has_include)
+#if __has_include(<atomic>)
+#define TR_SIM7000_HAS_ATOMIC 1
+#endif
+#endif
+#endif
+#ifndef TR_SIM7000_HAS_ATOMIC
+#define TR_SIM7000_HAS_ATOMIC 0
+#endif
+
+#if TR_SIM7000_HAS_ATOMIC
+#include <atomic>
+
+/**
+ * @class TR_SPSCQueue
+ * @brief Lock free single producer, single consumer ring buffer
+ * @details One thread, task or ISR may push and one other may pop without
+ *          locking. Capacity must be a power of two, one slot is kept free
+ *          to tell a full queue from an empty one.
+ */
+template <typename T, size_t CAPACITY>
+class TR_SPSCQueue
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0,
+                  "TR_SPSCQueue capacity must be a power of two");
+    
+    public:
+    
+   /**
+    * @fn push
+    * @brief Add an item, producer side only
+    * @param item Item to add
+    * @return bool type, indicating the item was added
+    * @retval true Success 
+    * @retval false Queue is full
+    */
+    bool push(const T &item)
+    {
+        size_t head = head_index.load(std::memory_order_relaxed);
+        size_t next = (head + 1) & (CAPACITY - 1);
+        if(next == tail_index.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        items[head] = item;
+        head_index.store(next, std::memory_order_release);
+        return true;
+    }
+    
+   /**
+    * @fn push
+    * @brief Add as many items as fit, producer side only
+    * @param src Items to add
+    * @param count Number of items to add
+    * @return Number of items added
+    */
+    size_t push(const T *src, size_t count)
+    {
+        size_t head = head_index.load(std::memory_order_relaxed);
+        size_t tail = tail_index.load(std::memory_order_acquire);
+        size_t space = (tail - head - 1) & (CAPACITY - 1);
+        if(count > space)
+        {
+            count = space;
+        }
+        for(size_t i = 0; i < count; i++)
+        {
+            items[(head + i) & (CAPACITY - 1)] = src[i];
+        }
+        head_index.store((head + count) & (CAPACITY - 1), std::memory_order_release);
+        return count;
+    }
+    
+   /**
+    * @fn pop
+    * @brief Remove the oldest item, consumer side only
+    * @param item Populated with the removed item
+    * @return bool type, indicating an item was removed
+    * @retval true Success 
+    * @retval false Queue is empty
+    */
+    bool pop(T &item)
+    {
+        size_t tail = tail_index.load(std::memory_order_relaxed);
+        if(tail == head_index.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = items[tail];
+        tail_index.store((tail + 1) & (CAPACITY - 1), std::memory_order_release);
+        return true;
+    }
+    
+   /**
+    * @fn pop
+    * @brief Remove up to count of the oldest items, consumer side only
+    * @param dst Buffer to populate with removed items
+    * @param count Maximum number of items to remove
+    * @return Number of items removed
+    */
+    size_t pop(T *dst, size_t count)
+    {
+        size_t tail = tail_index.load(std::memory_order_relaxed);
+        size_t head = head_index.load(std::memory_order_acquire);
+        size_t used = (head - tail) & (CAPACITY - 1);
+        if(count > used)
+        {
+            count = used;
+        }
+        for(size_t i = 0; i < count; i++)
+        {
+            dst[i] = items[(tail + i) & (CAPACITY - 1)];
+        }
+        tail_index.store((tail + count) & (CAPACITY - 1), std::memory_order_release);
+        return count;
+    }
+    
+   /**
+    * @fn peek
+    * @brief Look at the oldest item without removing it, consumer side only
+    * @param item Populated with the oldest item
+    * @return bool type, indicating an item was available
+    */
+    bool peek(T &item)
+    {
+        size_t tail = tail_index.load(std::memory_order_relaxed);
+        if(tail == head_index.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = items[tail];
+        return true;
+    }
+    
+   /**
+    * @fn available
+    * @brief Number of items waiting, exact from the consumer side
+    * @return Item count
+    */
+    size_t available(void) const
+    {
+        return (head_index.load(std::memory_order_acquire) -
+                tail_index.load(std::memory_order_acquire)) & (CAPACITY - 1);
+    }
+    
+    private:
+    
+    T items[CAPACITY];
+    std::atomic<size_t> head_index{0};
+    std::atomic<size_t> tail_index{0};
+};
+
+#endif
+
+#endif
@@ -0,0 +1,402 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/
+
+#include <TR_SerialTranscript.h>
+#include <TR_NoAlloc.h>
+
+TR_SerialRecorder::TR_SerialRecorder(Stream &port_in, Print &log_in)
+{
+    port = &port_in;
+    log = &log_in;
+}
+
+void TR_SerialRecorder::begin(uint32_t coalesce)
+{
+    coalesce_us = coalesce;
+    pending_len = 0;
+    ahead_head = 0;
+    ahead_count = 0;
+    
+    const uint8_t header[5] = {'T', 'R', 'S', 'R', TR_TRANSCRIPT_VERSION};
+    log->write(header, sizeof(header));
+    last_record_us = micros();
+}
+
+void TR_SerialRecorder::end(void)
+{
+    writeRecord();
+    log->flush();
+}
+
+int TR_SerialRecorder::available(void)
+{
+    capture();
+    return ahead_count + port->available();
+}
+
+int TR_SerialRecorder::read(void)
+{
+    capture();
+    if(ahead_count == 0)
+    {
+        return -1;
+    }
+    uint8_t c = ahead[ahead_head];
+    ahead_head = (ahead_head + 1) % TR_TRANSCRIPT_READAHEAD;
+    ahead_count--;
+    return c;
+}
+
+int TR_SerialRecorder::peek(void)
+{
+    capture();
+    if(ahead_count == 0)
+    {
+        return -1;
+    }
+    return ahead[ahead_head];
+}
+
+size_t TR_SerialRecorder::write(uint8_t c)
+{
+    // Keep responses that arrived before this command ahead of it
+    capture();
+    record(c, true);
+    return port->write(c);
+}
+
+size_t TR_SerialRecorder::write(const uint8_t *buffer, size_t size)
+{
+    capture();
+    for(size_t i = 0; i < size; i++)
+    {
+        record(buffer[i], true);
+    }
+    return port->write(buffer, size);
+}
+
+void TR_SerialRecorder::flush(void)
+{
+    port->flush();
+}
+
+void TR_SerialRecorder::capture(void)
+{
+    while(ahead_count < TR_TRANSCRIPT_READAHEAD && port->available())
+    {
+        int c = port->read();
+        if(c < 0)
+        {
+            break;
+        }
+        record((uint8_t)c, false);
+        ahead[(ahead_head + ahead_count) % TR_TRANSCRIPT_READAHEAD] = (uint8_t)c;
+        ahead_count++;
+    }
+}
+
+void TR_SerialRecorder::record(uint8_t c, bool tx)
+{
+    uint32_t now = micros();
+    
+    // Start a new record on a change of direction, a gap or a full record
+    if(pending_len > 0 &&
+       (tx != pending_tx ||
+        (now - pending_last_us) > coalesce_us ||
+        pending_len == TR_TRANSCRIPT_RECORD))
+    {
+        writeRecord();
+    }
+    
+    if(pending_len == 0)
+    {
+        pending_tx = tx;
+        pending_start_us = now;
+    }
+    pending[pending_len++] = c;
+    pending_last_us = now;
+}
+
+void TR_SerialRecorder::writeRecord(void)
+{
+    if(pending_len == 0)
+    {
+        return;
+    }
+    
+    uint8_t header[6];
+    uint8_t header_len = 0;
+    header[header_len++] = (pending_tx ? TR_TRANSCRIPT_TX : 0) | (pending_len - 1);
+    
+    // Time since the previous record as an unsigned LEB128 varint
+    uint32_t delta = pending_start_us - last_record_us;
+    do
+    {
+        uint8_t b = delta & 0x7F;
+        delta >>= 7;
+        if(delta > 0)
+        {
+            b |= 0x80;
+        }
+        header[header_len++] = b;
+    }
+    while(delta > 0);
+    
+    log->write(header, header_len);
+    log->write(pending, pending_len);
+    
+    last_record_us = pending_start_us;
+    pending_len = 0;
+}
+
+TR_SerialReplay::TR_SerialReplay(Stream &transcript_in)
+{
+    transcript = &transcript_in;
+}
+
+bool TR_SerialReplay::begin(bool real_time_in)
+{
+    real_time = real_time_in;
+    
+    uint8_t header[5];
+    for(uint8_t i = 0; i < sizeof(header); i++)
+    {
+        int c = readTranscript();
+        if(c < 0)
+        {
+            return false;
+        }
+        header[i] = (uint8_t)c;
+    }
+    if(0 != memcmp(header, "TRSR", 4) || header[4] != TR_TRANSCRIPT_VERSION)
+    {
+        return false;
+    }
+    
+    rx_head = 0;
+    rx_tail = 0;
+    mismatches = 0;
+    done = false;
+    record_valid = false;
+    last_played_us = micros();
+    
+    return true;
+}
+
+bool TR_SerialReplay::isDone(void)
+{
+    return done && (rx_head == rx_tail);
+}
+
+uint32_t TR_SerialReplay::getMismatches(void)
+{
+    return mismatches;
+}
+
+int TR_SerialReplay::available(void)
+{
+    advance(false);
+    return (uint16_t)(rx_head - rx_tail + sizeof(rx_buffer)) % sizeof(rx_buffer);
+}
+
+int TR_SerialReplay::read(void)
+{
+    advance(false);
+    if(rx_head == rx_tail)
+    {
+        return -1;
+    }
+    uint8_t c = rx_buffer[rx_tail];
+    rx_tail = (rx_tail + 1) % sizeof(rx_buffer);
+    return c;
+}
+
+int TR_SerialReplay::peek(void)
+{
+    advance(false);
+    if(rx_head == rx_tail)
+    {
+        return -1;
+    }
+    return rx_buffer[rx_tail];
+}
+
+size_t TR_SerialReplay::write(uint8_t c)
+{
+    // A write means the driver has moved on, so any response recorded
+    // before this command is released first
+    while(record_valid || !done)
+    {
+        if(!record_valid && !loadRecord())
+        {
+            break;
+        }
+        if(record_tx)
+        {
+            break;
+        }
+        advance(true);
+        if(record_valid)
+        {
+            // No room for the response until the driver reads
+            break;
+        }
+    }
+    
+    if(!record_valid || !record_tx)
+    {
+        mismatches++;
+        return 1;
+    }
+    
+    if(record_data[record_pos] != c)
+    {
+        mismatches++;
+    }
+    record_pos++;
+    
+    if(record_pos == record_len)
+    {
+        record_valid = false;
+        last_played_us = micros();
+    }
+    return 1;
+}
+
+size_t TR_SerialReplay::write(const uint8_t *buffer, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+void TR_SerialReplay::advance(bool force)
+{
+    while(1)
+    {
+        if(!record_valid && !loadRecord())
+        {
+            return;
+        }
+        
+        // Commands are consumed by write()
+        if(record_tx)
+        {
+            return;
+        }
+        
+        // Delays are measured from the previous record so a driver running
+        // slower or faster than the recording keeps the relative timing
+        if(real_time && !force && (micros() - last_played_us) < record_delta_us)
+        {
+            return;
+        }
+        
+        // Release the whole response, waiting for the driver to make room
+        uint16_t space = (rx_tail - rx_head - 1 + sizeof(rx_buffer)) % sizeof(rx_buffer);
+        if(space < (uint16_t)(record_len - record_pos))
+        {
+            return;
+        }
+        while(record_pos < record_len)
+        {
+            rx_buffer[rx_head] = record_data[record_pos++];
+            rx_head = (rx_head + 1) % sizeof(rx_buffer);
+        }
+        record_valid = false;
+        last_played_us = micros();
+        
+        if(force)
+        {
+            return;
+        }
+    }
+}
+
+bool TR_SerialReplay::loadRecord(void)
+{
+    if(done)
+    {
+        return false;
+    }
+    
+    int tag = readTranscript();
+    if(tag < 0)
+    {
+        done = true;
+        return false;
+    }
+    
+    uint32_t delta = 0;
+    uint8_t shift = 0;
+    while(1)
+    {
+        int b = readTranscript();
+        if(b < 0)
+        {
+            done = true;
+            return false;
+        }
+        delta |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+        if(!(b & 0x80) || shift > 28)
+        {
+            break;
+        }
+    }
+    
+    record_tx = (tag & TR_TRANSCRIPT_TX) != 0;
+    record_len = (tag & 0x7F) + 1;
+    record_pos = 0;
+    record_delta_us = delta;
+    for(uint8_t i = 0; i < record_len; i++)
+    {
+        int c = readTranscript();
+        if(c < 0)
+        {
+            done = true;
+            return false;
+        }
+        record_data[i] = (uint8_t)c;
+    }
+    
+    record_valid = true;
+    return true;
+}
+
+int TR_SerialReplay::readTranscript(void)
+{
+    if(!transcript->available())
+    {
+        return -1;
+    }
+    return transcript->read();
+}
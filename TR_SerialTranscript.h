@@ -0,0 +1,234 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_SERIALTRANSCRIPT_H_
+#define _TR_SERIALTRANSCRIPT_H_
+
+#include "Arduino.h"
+
+/*
+ * Transcript format
+ *
+ * Header: "TRSR" followed by a version byte.
+ * Records: a tag byte, the time since the previous record in microseconds
+ * as an unsigned LEB128 varint, then the data bytes. The tag's top bit is
+ * set for bytes written to the SIM7000 (TX) and clear for bytes read from
+ * it (RX), the low 7 bits hold the data length minus one.
+ */
+#define TR_TRANSCRIPT_VERSION 1
+#define TR_TRANSCRIPT_TX      0x80
+#define TR_TRANSCRIPT_RECORD  128
+
+// Bytes the recorder reads ahead of the driver so they are stamped when
+// they first become available rather than when the driver reads them
+#ifndef TR_TRANSCRIPT_READAHEAD
+#define TR_TRANSCRIPT_READAHEAD 64
+#endif
+
+/**
+ * @class TR_SerialRecorder
+ * @brief Stream placed between TR_SIM7000 and its serial port that logs
+ *        every byte written and read with timestamps
+ * @details Received bytes are stamped the first time available(), read()
+ *          or peek() finds them, so a driver that polls available() and
+ *          reads later records the arrival time, not the read time.
+ */
+class TR_SerialRecorder : public Stream
+{
+    public:
+    
+    /**
+     * @fn TR_SerialRecorder
+     * @brief Recorder constructor
+     * @param port_in SIM7000 serial port
+     * @param log_in Destination for the transcript, for example an SD file
+     * @return None
+     */
+    TR_SerialRecorder(Stream &port_in, Print &log_in);
+    
+   /**
+    * @fn begin
+    * @brief Write the transcript header and start timing
+    * @param coalesce Bytes in the same direction less than this many
+    *        microseconds apart share a record and its timestamp
+    */
+    void begin(uint32_t coalesce = 1000);
+    
+   /**
+    * @fn end
+    * @brief Write any pending record to the transcript
+    */
+    void end(void);
+    
+    int available(void) override;
+    int read(void) override;
+    int peek(void) override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    void flush(void) override;
+    using Print::write;
+    
+    private:
+    
+    Stream *port;
+    Print *log;
+    
+    uint32_t coalesce_us = 1000;
+    
+    // Time the previous record started
+    uint32_t last_record_us = 0;
+    
+    // Received bytes already recorded but not yet read by the driver
+    uint8_t ahead[TR_TRANSCRIPT_READAHEAD];
+    uint8_t ahead_head = 0;
+    uint8_t ahead_count = 0;
+    
+    // Record being collected
+    uint8_t pending[TR_TRANSCRIPT_RECORD];
+    uint8_t pending_len = 0;
+    bool pending_tx = false;
+    uint32_t pending_start_us = 0;
+    uint32_t pending_last_us = 0;
+    
+    /**
+     * @fn capture
+     * @brief Record bytes the port has received and hold them for the
+     *        driver
+     */
+    void capture(void);
+    
+    /**
+     * @fn record
+     * @brief Add a byte to the transcript
+     */
+    void record(uint8_t c, bool tx);
+    
+    /**
+     * @fn writeRecord
+     * @brief Write the pending record to the transcript
+     */
+    void writeRecord(void);
+};
+
+/**
+ * @class TR_SerialReplay
+ * @brief Stream that plays a recorded transcript back to TR_SIM7000 in
+ *        place of the serial port. Recorded responses are released only
+ *        after the driver has written the commands that preceded them,
+ *        either with the recorded delays or as fast as possible.
+ */
+class TR_SerialReplay : public Stream
+{
+    public:
+    
+    /**
+     * @fn TR_SerialReplay
+     * @brief Replay constructor
+     * @param transcript_in Source of a transcript written by
+     *        TR_SerialRecorder, for example an SD file
+     * @return None
+     */
+    TR_SerialReplay(Stream &transcript_in);
+    
+   /**
+    * @fn begin
+    * @brief Check the transcript header and start playback
+    * @param real_time true to keep the recorded timing, false to release
+    *        responses as soon as their commands have been written
+    * @return bool type, indicating the transcript header is valid
+    */
+    bool begin(bool real_time);
+    
+   /**
+    * @fn isDone
+    * @brief Check whether every record has been played back
+    * @return bool type, indicating playback is complete
+    */
+    bool isDone(void);
+    
+   /**
+    * @fn getMismatches
+    * @brief Number of bytes written by the driver that differ from the
+    *        recorded session
+    * @return Byte count
+    */
+    uint32_t getMismatches(void);
+    
+    int available(void) override;
+    int read(void) override;
+    int peek(void) override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    
+    private:
+    
+    Stream *transcript;
+    bool real_time = false;
+    
+    // Record at the playback position
+    uint8_t record_data[TR_TRANSCRIPT_RECORD];
+    uint8_t record_len = 0;
+    uint8_t record_pos = 0;
+    bool record_tx = false;
+    bool record_valid = false;
+    uint32_t record_delta_us = 0;
+    
+    // Time the previous record was played back
+    uint32_t last_played_us = 0;
+    
+    // Responses released to the driver
+    uint8_t rx_buffer[256];
+    uint16_t rx_head = 0;
+    uint16_t rx_tail = 0;
+    
+    uint32_t mismatches = 0;
+    bool done = false;
+    
+    /**
+     * @fn advance
+     * @brief Release responses that are due
+     * @param force Release the next response even if it is not due yet
+     */
+    void advance(bool force);
+    
+    /**
+     * @fn loadRecord
+     * @brief Read the next record from the transcript
+     */
+    bool loadRecord(void);
+    
+    /**
+     * @fn readTranscript
+     * @brief Read a byte from the transcript
+     */
+    int readTranscript(void);
+};
+
+#endif
@@ -0,0 +1,198 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/
+
+#include <TR_Sourcetable.h>
+#include <math.h>
+#include <TR_NoAlloc.h>
+
+// STR record fields used for selection
+#define STR_MNTPNT     1
+#define STR_FORMAT     3
+#define STR_NAV_SYSTEM 6
+#define STR_LATITUDE   9
+#define STR_LONGITUDE  10
+#define STR_FIELDS     11
+
+TR_Sourcetable::TR_Sourcetable()
+{
+    nearest[0] = '\0';
+}
+
+void TR_Sourcetable::setFilter(const char* format,
+                               const char* nav_system)
+{
+    format_filter = format;
+    nav_filter = nav_system;
+}
+
+void TR_Sourcetable::begin(double lat, double lon)
+{
+    rover_lat = lat;
+    rover_lon = lon;
+    line_len = 0;
+    line_overflow = false;
+    nearest[0] = '\0';
+    nearest_distance = 0;
+    count = 0;
+    complete = false;
+}
+
+void TR_Sourcetable::feed(const char *data, uint16_t len)
+{
+    for(uint16_t i = 0; i < len && !complete; i++)
+    {
+        char c = data[i];
+        if(c == '\r')
+        {
+            continue;
+        }
+        
+        if(c == '\n')
+        {
+            if(!line_overflow)
+            {
+                line[line_len] = '\0';
+                parseLine();
+            }
+            line_len = 0;
+            line_overflow = false;
+            continue;
+        }
+        
+        if(line_len < TR_SOURCETABLE_LINE - 1)
+        {
+            line[line_len++] = c;
+        }
+        else
+        {
+            line_overflow = true;
+        }
+    }
+}
+
+bool TR_Sourcetable::isComplete(void)
+{
+    return complete;
+}
+
+bool TR_Sourcetable::isCachedFor(double lat, double lon, float radius)
+{
+    if(!complete || nearest[0] == '\0')
+    {
+        return false;
+    }
+    return distance(lat, lon, rover_lat, rover_lon) <= radius;
+}
+
+const char* TR_Sourcetable::getNearest(void)
+{
+    return nearest;
+}
+
+float TR_Sourcetable::getNearestDistance(void)
+{
+    return nearest_distance;
+}
+
+uint16_t TR_Sourcetable::getCount(void)
+{
+    return count;
+}
+
+void TR_Sourcetable::parseLine(void)
+{
+    if(0 == strncmp(line, "ENDSOURCETABLE", 14))
+    {
+        complete = true;
+        return;
+    }
+    if(0 != strncmp(line, "STR;", 4))
+    {
+        return;
+    }
+    count++;
+    
+    // Split the fields in place
+    char *fields[STR_FIELDS];
+    uint8_t num_fields = 0;
+    char *field = line;
+    while(num_fields < STR_FIELDS)
+    {
+        fields[num_fields++] = field;
+        char *separator = strchr(field, ';');
+        if(separator == NULL)
+        {
+            break;
+        }
+        *separator = '\0';
+        field = separator + 1;
+    }
+    if(num_fields < STR_FIELDS)
+    {
+        return;
+    }
+    
+    if(format_filter != NULL && NULL == strstr(fields[STR_FORMAT], format_filter))
+    {
+        return;
+    }
+    if(nav_filter != NULL && NULL == strstr(fields[STR_NAV_SYSTEM], nav_filter))
+    {
+        return;
+    }
+    
+    double lat = atof(fields[STR_LATITUDE]);
+    double lon = atof(fields[STR_LONGITUDE]);
+    float dist = distance(rover_lat, rover_lon, lat, lon);
+    
+    if(nearest[0] == '\0' || dist < nearest_distance)
+    {
+        strncpy(nearest, fields[STR_MNTPNT], TR_SOURCETABLE_MNTPNT - 1);
+        nearest[TR_SOURCETABLE_MNTPNT - 1] = '\0';
+        nearest_distance = dist;
+    }
+}
+
+float TR_Sourcetable::distance(double lat1, double lon1, double lat2, double lon2)
+{
+    // Equirectangular approximation is plenty to rank nearby bases
+    const double deg_to_rad = M_PI / 180.0;
+    double dlon = lon2 - lon1;
+    if(dlon > 180.0)
+    {
+        dlon -= 360.0;
+    }
+    else if(dlon < -180.0)
+    {
+        dlon += 360.0;
+    }
+    double x = dlon * deg_to_rad * cos((lat1 + lat2) * 0.5 * deg_to_rad);
+    double y = (lat2 - lat1) * deg_to_rad;
+    return (float)(6371.0 * sqrt((x * x) + (y * y)));
+}
@@ -0,0 +1,157 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+#ifndef _TR_SOURCETABLE_H_
+#define _TR_SOURCETABLE_H_
+
+#include "Arduino.h"
+
+// Longest sourcetable record kept, longer records are ignored
+#ifndef TR_SOURCETABLE_LINE
+#define TR_SOURCETABLE_LINE 256
+#endif
+
+// Longest mount point name kept
+#define TR_SOURCETABLE_MNTPNT 64
+
+class TR_Sourcetable
+{
+    public:
+    
+    /**
+     * @fn TR_Sourcetable
+     * @brief Sourcetable parser constructor
+     * @return None
+     */
+    TR_Sourcetable();
+    
+   /**
+    * @fn setFilter
+    * @brief Only consider mount points whose format and navigation system
+    *        fields contain the given text
+    * @param format Text the format field must contain, for example
+    *        "RTCM 3", or NULL for any format
+    * @param nav_system Text the navigation system field must contain, for
+    *        example "GPS", or NULL for any system
+    */
+    void setFilter(const char* format,
+                   const char* nav_system = NULL);
+    
+   /**
+    * @fn begin
+    * @brief Start parsing a new sourcetable
+    * @param lat Rover latitude (degrees)
+    * @param lon Rover longitude (degrees)
+    */
+    void begin(double lat, double lon);
+    
+   /**
+    * @fn feed
+    * @brief Parse the next chunk of the sourcetable, only the current line
+    *        is held in memory
+    * @param data Chunk of the caster response
+    * @param len Length of the chunk
+    */
+    void feed(const char *data, uint16_t len);
+    
+   /**
+    * @fn isComplete
+    * @brief Check whether ENDSOURCETABLE has been parsed
+    * @return bool type, indicating the whole table was parsed
+    */
+    bool isComplete(void);
+    
+   /**
+    * @fn isCachedFor
+    * @brief Check whether the parsed result can be reused for a position
+    * @param lat Rover latitude (degrees)
+    * @param lon Rover longitude (degrees)
+    * @param radius Distance (km) the rover may have moved since the table
+    *        was parsed
+    * @return bool type, indicating the cached mount point is still valid
+    */
+    bool isCachedFor(double lat, double lon, float radius = 10.0);
+    
+   /**
+    * @fn getNearest
+    * @brief Nearest suitable mount point
+    * @return Mount point name, empty if none was found
+    */
+    const char* getNearest(void);
+    
+   /**
+    * @fn getNearestDistance
+    * @brief Distance to the nearest suitable mount point
+    * @return Distance (km)
+    */
+    float getNearestDistance(void);
+    
+   /**
+    * @fn getCount
+    * @brief Number of STR records parsed
+    * @return Record count
+    */
+    uint16_t getCount(void);
+
+    private:
+    
+    // Line being assembled
+    char line[TR_SOURCETABLE_LINE];
+    uint16_t line_len = 0;
+    bool line_overflow = false;
+    
+    // Filters on format and navigation system
+    const char* format_filter = NULL;
+    const char* nav_filter = NULL;
+    
+    // Position the table is being parsed for
+    double rover_lat = 0;
+    double rover_lon = 0;
+    
+    // Nearest suitable mount point found so far
+    char nearest[TR_SOURCETABLE_MNTPNT];
+    float nearest_distance = 0;
+    
+    uint16_t count = 0;
+    bool complete = false;
+    
+    /**
+     * @fn parseLine
+     * @brief Handle a complete sourcetable line
+     */
+    void parseLine(void);
+    
+    /**
+     * @fn distance
+     * @brief Approximate distance (km) between two positions
+     */
+    float distance(double lat1, double lon1, double lat2, double lon2);
+};
+
+#endif
@@ -0,0 +1,179 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+* 
+* Authors: 
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+* 
+**********************************************************************/       
+
+/*
+ * Minimal Arduino core for building the library on a Linux host, used by
+ * the harnesses in this directory. Timing comes from the system clock,
+ * Serial writes to stdout and pin functions do nothing.
+ */
+
+#ifndef _TR_HOST_ARDUINO_H_
+#define _TR_HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <chrono>
+#include <thread>
+
+typedef bool boolean;
+
+#define HIGH   1
+#define LOW    0
+#define INPUT  0
+#define OUTPUT 1
+
+inline unsigned long micros(void)
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return (unsigned long)(uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long millis(void)
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return (unsigned long)(uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+inline void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+inline void yield(void)
+{
+    std::this_thread::yield();
+}
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+
+class String
+{
+    public:
+    
+    String() {}
+    String(const char *c) : value(c) {}
+    String(int v) : value(std::to_string(v)) {}
+    
+    const char* c_str(void) const { return value.c_str(); }
+    unsigned int length(void) const { return value.size(); }
+    
+    friend String operator+(const String &a, const String &b) { return String((a.value + b.value).c_str()); }
+    
+    private:
+    
+    std::string value;
+};
+
+class Print
+{
+    public:
+    
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while(n < size && write(buffer[n]))
+        {
+            n++;
+        }
+        return n;
+    }
+    size_t write(const char *str) { return write((const uint8_t*)str, strlen(str)); }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual int availableForWrite(void) { return 0; }
+    virtual void flush(void) {}
+    
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long v, int base = 10) { return printNumber(v, base); }
+    size_t print(int v, int base = 10) { return printNumber(v, base); }
+    size_t print(unsigned long v, int base = 10) { return printNumber((long long)v, base); }
+    size_t print(unsigned int v, int base = 10) { return printNumber(v, base); }
+    size_t print(double v, int digits = 2)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.*f", digits, v);
+        return write(buffer);
+    }
+    
+    size_t println(void) { return write("\r\n"); }
+    template <typename T> size_t println(T v) { return print(v) + println(); }
+    template <typename T> size_t println(T v, int format) { return print(v, format) + println(); }
+    
+    private:
+    
+    size_t printNumber(long long v, int base)
+    {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), (base == 16) ? "%llX" : "%lld", v);
+        return write(buffer);
+    }
+};
+
+class Stream : public Print
+{
+    public:
+    
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+    using Print::write;
+};
+
+// Serial monitor on stdout, nothing is ever received
+class HardwareSerial : public Stream
+{
+    public:
+    
+    void begin(long) {}
+    int available(void) override { return 0; }
+    int read(void) override { return -1; }
+    int peek(void) override { return -1; }
+    size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+    using Print::write;
+};
+
+inline HardwareSerial Serial;
+
+#endif
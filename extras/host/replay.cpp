@@ -0,0 +1,256 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+* Authors:
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+*
+**********************************************************************/
+
+/*
+ * Plays a transcript written by TR_SerialRecorder back to TR_SIM7000 on a
+ * Linux host. The driver runs the usual client session, connect(),
+ * establishTCPConnectionClient() then readTCP() until the transcript ends,
+ * and the time each step took is reported with any bytes the driver wrote
+ * that differ from the recording. Use the settings of the recorded session
+ * so the commands match.
+ *
+ * Build from the library folder:
+ *   g++ -std=gnu++17 -O2 -Iextras/host -I. extras/host/replay.cpp \
+ *       TR_SIM7000.cpp TR_SerialTranscript.cpp TR_CMUX.cpp TR_Latency.cpp \
+ *       TR_NMEAParser.cpp TR_Sourcetable.cpp -o replay
+ * Run:
+ *   ./replay session.trs [--fast] [--ca] [--host name] [--port 2101]
+ *            [--mount name] [--user name] [--password secret] [--apn name]
+ *            [--timeout seconds]
+ * --fast releases each response as soon as its command has been written
+ * instead of keeping the recorded delays.
+ *
+ * Add -DTR_SIM7000_NO_ALLOC -DTR_SIM7000_COUNT_ALLOC to the build to also
+ * check that the session makes no heap allocation.
+ */
+
+#include <TR_SIM7000.h>
+#include <TR_SerialTranscript.h>
+
+#include <signal.h>
+#include <unistd.h>
+
+// Transcript file as a Stream
+class FileStream : public Stream
+{
+    public:
+
+    bool open(const char *path)
+    {
+        file = fopen(path, "rb");
+        if(file == NULL)
+        {
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        remaining = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        return true;
+    }
+
+    int available(void) override
+    {
+        return remaining;
+    }
+
+    int read(void) override
+    {
+        int c = fgetc(file);
+        if(c != EOF)
+        {
+            remaining--;
+        }
+        return (c == EOF) ? -1 : c;
+    }
+
+    int peek(void) override
+    {
+        int c = fgetc(file);
+        if(c != EOF)
+        {
+            ungetc(c, file);
+        }
+        return (c == EOF) ? -1 : c;
+    }
+
+    size_t write(uint8_t) override
+    {
+        return 0;
+    }
+    using Print::write;
+
+    private:
+
+    FILE *file = NULL;
+    long remaining = 0;
+};
+
+static void timedOut(int)
+{
+    static const char message[] = "\nFAIL: replay timed out\n";
+    if(write(STDOUT_FILENO, message, sizeof(message) - 1) < 0)
+    {
+        _exit(2);
+    }
+    _exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        printf("Usage: %s transcript [--fast] [--ca] [--host name] [--port n] "
+               "[--mount name] [--user name] [--password secret] [--apn name] "
+               "[--timeout seconds]\n", argv[0]);
+        return 1;
+    }
+
+    static char apn[64] = "hologram";
+    static char host[64] = "rtk2go.com";
+    static char mount[64] = "MOUNT";
+    static char user[64] = "";
+    static char password[64] = "";
+    static char info[] = "";
+    int tcp_port = 2101;
+    bool real_time = true;
+    TR_SIM7000::eStack stack = TR_SIM7000::eCIP;
+    unsigned int timeout = 600;
+
+    for(int i = 2; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if(0 == strcmp(arg, "--fast"))
+        {
+            real_time = false;
+            continue;
+        }
+        if(0 == strcmp(arg, "--ca"))
+        {
+            stack = TR_SIM7000::eCA;
+            continue;
+        }
+        if(value == NULL)
+        {
+            printf("Missing value for %s\n", arg);
+            return 1;
+        }
+        i++;
+        if(0 == strcmp(arg, "--host"))          snprintf(host, sizeof(host), "%s", value);
+        else if(0 == strcmp(arg, "--port"))     tcp_port = atoi(value);
+        else if(0 == strcmp(arg, "--mount"))    snprintf(mount, sizeof(mount), "%s", value);
+        else if(0 == strcmp(arg, "--user"))     snprintf(user, sizeof(user), "%s", value);
+        else if(0 == strcmp(arg, "--password")) snprintf(password, sizeof(password), "%s", value);
+        else if(0 == strcmp(arg, "--apn"))      snprintf(apn, sizeof(apn), "%s", value);
+        else if(0 == strcmp(arg, "--timeout"))  timeout = atoi(value);
+        else
+        {
+            printf("Unknown option %s\n", arg);
+            return 1;
+        }
+    }
+
+    FileStream transcript;
+    if(!transcript.open(argv[1]))
+    {
+        printf("Cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    TR_SerialReplay replay(transcript);
+    if(!replay.begin(real_time))
+    {
+        printf("%s is not a transcript\n", argv[1]);
+        return 1;
+    }
+
+    // Some connection steps wait forever for a SIM7000 that stops answering
+    signal(SIGALRM, timedOut);
+    alarm(timeout);
+
+    TR_SIM7000 modem;
+    modem.init(0, 0, apn, host, tcp_port, mount, user, password, info, replay, stack);
+
+#ifdef TR_SIM7000_COUNT_ALLOC
+    uint32_t allocations = TR_SIM7000::getAllocationCount();
+#endif
+
+    uint32_t start = millis();
+    bool connected = modem.connect();
+    uint32_t connect_ms = millis() - start;
+
+    uint32_t established_ms = 0;
+    uint32_t first_data_ms = 0;
+    uint32_t received = 0;
+    bool established = false;
+    if(connected)
+    {
+        start = millis();
+        established = modem.establishTCPConnectionClient();
+        established_ms = millis() - start;
+    }
+
+    // Corrections until the recorded session ends
+    start = millis();
+    if(established)
+    {
+        char chunk[512];
+        while(!replay.isDone())
+        {
+            uint16_t len = modem.readTCP(chunk, sizeof(chunk));
+            if(len > 0 && received == 0)
+            {
+                first_data_ms = millis() - start;
+            }
+            received += len;
+        }
+    }
+    uint32_t stream_ms = millis() - start;
+
+    printf("\nReplay of %s (%s)\n", argv[1], real_time ? "recorded timing" : "fast");
+    printf("  connect():                      %s in %lu ms\n",
+           connected ? "ok" : "failed", (unsigned long)connect_ms);
+    printf("  establishTCPConnectionClient(): %s in %lu ms\n",
+           established ? "ok" : (connected ? "failed" : "skipped"),
+           (unsigned long)established_ms);
+    printf("  corrections:                    %lu bytes, first after %lu ms, %lu ms total\n",
+           (unsigned long)received, (unsigned long)first_data_ms, (unsigned long)stream_ms);
+    printf("  mismatched bytes written:       %lu\n", (unsigned long)replay.getMismatches());
+    printf("  transcript fully played:        %s\n", replay.isDone() ? "yes" : "no");
+
+    bool pass = established && replay.isDone() && replay.getMismatches() == 0;
+
+#ifdef TR_SIM7000_COUNT_ALLOC
+    allocations = TR_SIM7000::getAllocationCount() - allocations;
+    printf("  heap allocations:               %lu\n", (unsigned long)allocations);
+    pass = pass && allocations == 0;
+#endif
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
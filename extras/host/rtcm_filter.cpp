@@ -0,0 +1,141 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+* Authors:
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+*
+**********************************************************************/
+
+/*
+ * Checks TR_RTCMFilter on a Linux host with generated RTCM 3 frames. Frames
+ * are fed in small chunks so they span calls to filter(), and the default
+ * action is changed after message types have been seen to check that types
+ * without a rule of their own follow it.
+ *
+ * Build and run from the library folder:
+ *   g++ -std=gnu++17 -O2 -Iextras/host -I. extras/host/rtcm_filter.cpp \
+ *       TR_RTCMFilter.cpp -o rtcm_filter
+ *   ./rtcm_filter
+ */
+
+#include <TR_RTCMFilter.h>
+
+#include <vector>
+
+// CRC-24Q as used by RTCM 3
+static uint32_t crc24q(const std::vector<uint8_t> &bytes)
+{
+    uint32_t crc = 0;
+    for(uint8_t b : bytes)
+    {
+        crc ^= (uint32_t)b << 16;
+        for(int i = 0; i < 8; i++)
+        {
+            crc <<= 1;
+            if(crc & 0x1000000)
+            {
+                crc ^= 0x1864CFB;
+            }
+        }
+    }
+    return crc & 0xFFFFFF;
+}
+
+// Append a valid frame of a message type with a payload of len bytes
+static void addFrame(std::vector<uint8_t> &stream, uint16_t msg_type, uint16_t len)
+{
+    std::vector<uint8_t> frame = {0xD3, (uint8_t)(len >> 8), (uint8_t)len,
+                                  (uint8_t)(msg_type >> 4), (uint8_t)((msg_type & 0x0F) << 4)};
+    for(uint16_t i = 2; i < len; i++)
+    {
+        frame.push_back((uint8_t)i);
+    }
+    uint32_t crc = crc24q(frame);
+    frame.push_back((uint8_t)(crc >> 16));
+    frame.push_back((uint8_t)(crc >> 8));
+    frame.push_back((uint8_t)crc);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+}
+
+// Filter a stream in chunks, returning the bytes forwarded
+static size_t filterStream(TR_RTCMFilter &filter, const std::vector<uint8_t> &stream)
+{
+    static char out[64 + TR_RTCM_MAX_FRAME];
+    size_t forwarded = 0;
+    for(size_t i = 0; i < stream.size(); i += 64)
+    {
+        uint16_t len = (stream.size() - i < 64) ? stream.size() - i : 64;
+        forwarded += filter.filter((const char*)&stream[i], len, out, sizeof(out));
+    }
+    return forwarded;
+}
+
+static bool check(const char *what, uint32_t value, uint32_t expected)
+{
+    printf("%-40s %lu", what, (unsigned long)value);
+    if(value != expected)
+    {
+        printf(" (expected %lu)\n", (unsigned long)expected);
+        return false;
+    }
+    printf("\n");
+    return true;
+}
+
+int main(void)
+{
+    TR_RTCMFilter filter;
+    filter.setRule(1005, TR_RTCMFilter::ePass);
+    
+    std::vector<uint8_t> stream;
+    for(int i = 0; i < 4; i++)
+    {
+        addFrame(stream, 1005, 19);
+        addFrame(stream, 1077, 100);
+        addFrame(stream, 1087, 80);
+    }
+    
+    // Types without a rule pass while the default is ePass
+    filterStream(filter, stream);
+    
+    // and are dropped once it changes, though they have counters already
+    filter.setDefaultAction(TR_RTCMFilter::eDrop);
+    filterStream(filter, stream);
+    
+    // A rule set for a type stays in force
+    filter.setRule(1077, TR_RTCMFilter::eDecimate, 2);
+    filter.setDefaultAction(TR_RTCMFilter::ePass);
+    filterStream(filter, stream);
+    
+    bool pass = true;
+    pass &= check("1005 passed (rule ePass)", filter.getPassed(1005), 12);
+    pass &= check("1077 passed (default, then decimated)", filter.getPassed(1077), 6);
+    pass &= check("1077 dropped", filter.getDropped(1077), 6);
+    pass &= check("1087 passed (default ePass)", filter.getPassed(1087), 8);
+    pass &= check("1087 dropped (default eDrop)", filter.getDropped(1087), 4);
+    pass &= check("CRC errors", filter.getCRCErrors(), 0);
+    
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
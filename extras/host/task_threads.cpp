@@ -0,0 +1,251 @@
+/**********************************************************************
+*
+* MIT License
+*
+* Copyright (c) 2024 Tinkerbug Robotics
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+* Authors:
+* Christian Pedersen; tinkerbug@tinkerbugrobotics.com
+*
+**********************************************************************/
+
+/*
+ * Runs TR_SIM7000Task on Linux with std::thread: an RX thread stands in for
+ * the UART ISR, a driver thread calls run(), several application threads
+ * submit commands and the main thread reads corrections. The SIM7000 is
+ * simulated, answering every command with OK and pushing numbered
+ * correction data framed by +IPD headers.
+ *
+ * Build and run from the library folder:
+ *   g++ -std=gnu++17 -O2 -pthread -Iextras/host -I. extras/host/task_threads.cpp \
+ *       TR_SIM7000.cpp TR_SIM7000Task.cpp TR_CMUX.cpp TR_Latency.cpp \
+ *       TR_NMEAParser.cpp TR_Sourcetable.cpp -o task_threads
+ *   ./task_threads
+ * Add -fsanitize=thread to check the queues for data races.
+ */
+
+#include <TR_SIM7000.h>
+#include <TR_SIM7000Task.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define APP_THREADS      4
+#define COMMANDS_PER_APP 50
+
+// Simulated SIM7000, shared by the driver thread (writes) and RX thread
+class SimulatedModem : public Stream
+{
+    public:
+
+    // Queue a numbered chunk of correction data
+    void pushCorrections(uint8_t len)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        char header[16];
+        snprintf(header, sizeof(header), "+IPD,%d:", len);
+        output += header;
+        for(uint8_t i = 0; i < len; i++)
+        {
+            output += (char)(sequence++);
+        }
+    }
+
+    int available(void) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return output.size();
+    }
+
+    int read(void) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(output.empty())
+        {
+            return -1;
+        }
+        uint8_t c = output[0];
+        output.erase(0, 1);
+        return c;
+    }
+
+    int peek(void) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return output.empty() ? -1 : (uint8_t)output[0];
+    }
+
+    size_t write(uint8_t c) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Every command line is answered with OK
+        if(c == '\n')
+        {
+            output += "\r\nOK\r\n";
+        }
+        return 1;
+    }
+    using Print::write;
+
+    private:
+
+    std::mutex mutex;
+    std::string output;
+    uint8_t sequence = 0;
+};
+
+int main(void)
+{
+    SimulatedModem port;
+    TR_QueuedStream stream(port);
+
+    static char apn[] = "apn";
+    static char host[] = "caster";
+    static char mntpnt[] = "MOUNT";
+    static char empty[] = "";
+    int tcp_port = 2101;
+    TR_SIM7000 modem;
+    modem.init(0, 0, apn, host, tcp_port, mntpnt, empty, empty, empty, stream);
+
+    std::atomic<bool> stop(false);
+
+    // Stands in for the UART ISR
+    std::thread rx_thread([&]()
+    {
+        while(!stop)
+        {
+            stream.pumpRx();
+            delayMicroseconds(100);
+        }
+    });
+
+    // Enabled before the driver task starts, it is the only writer after
+    char stash[512];
+    if(!modem.setReceiveBuffer(stash, sizeof(stash)))
+    {
+        printf("FAIL: receive buffer not set\n");
+        stop = true;
+        rx_thread.join();
+        return 1;
+    }
+
+    TR_SIM7000Task task(modem);
+    std::thread driver_thread([&]()
+    {
+        while(!stop)
+        {
+            task.run();
+            yield();
+        }
+    });
+
+    // Corrections arrive while commands are running
+    std::thread data_thread([&]()
+    {
+        while(!stop)
+        {
+            port.pushCorrections(32);
+            delay(5);
+        }
+    });
+
+    std::atomic<uint32_t> succeeded(0);
+    std::atomic<uint32_t> failed(0);
+    std::vector<std::thread> app_threads;
+    for(int t = 0; t < APP_THREADS; t++)
+    {
+        app_threads.emplace_back([&]()
+        {
+            for(int i = 0; i < COMMANDS_PER_APP; i++)
+            {
+                TR_SIM7000Task::modemRequest req;
+                // Commands read until the line is idle this long, the
+                // simulated SIM7000 answers at once
+                if(!task.submitCommand(req, "AT+CSQ\r\n", "OK", 20))
+                {
+                    // A full queue marks the request failed right away
+                    if(req.status.load() != TR_SIM7000Task::eFailed)
+                    {
+                        printf("FAIL: rejected request left pending\n");
+                    }
+                    delay(1);
+                    i--;
+                    continue;
+                }
+                if(task.wait(req, 5000))
+                {
+                    succeeded++;
+                }
+                else
+                {
+                    failed++;
+
+                    // The request must not go out of scope while queued
+                    task.wait(req, 60000);
+                }
+            }
+        });
+    }
+
+    // Correction bytes must arrive complete and in order
+    uint32_t received = 0;
+    uint32_t gaps = 0;
+    uint8_t expected = 0;
+    uint32_t start = millis();
+    while(succeeded + failed < APP_THREADS * COMMANDS_PER_APP &&
+          (millis() - start) < 60000)
+    {
+        char chunk[128];
+        uint16_t len = task.readCorrections(chunk, sizeof(chunk));
+        for(uint16_t i = 0; i < len; i++)
+        {
+            if((uint8_t)chunk[i] != expected)
+            {
+                gaps++;
+            }
+            expected = (uint8_t)chunk[i] + 1;
+        }
+        received += len;
+        delay(1);
+    }
+
+    stop = true;
+    for(std::thread &app : app_threads)
+    {
+        app.join();
+    }
+    data_thread.join();
+    driver_thread.join();
+    rx_thread.join();
+
+    printf("Commands: %u succeeded, %u failed\n",
+           (unsigned)succeeded.load(), (unsigned)failed.load());
+    printf("Corrections: %u bytes, %u gaps, %u RX overflows, %u correction overflows, %u receive buffer overflows\n",
+           (unsigned)received, (unsigned)gaps, (unsigned)stream.getOverflows(),
+           (unsigned)task.getCorrectionOverflows(), (unsigned)modem.getReceiveOverflows());
+
+    bool pass = (failed == 0 && gaps == 0 && received > 0);
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}